@@ -0,0 +1,363 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "BitBang.hpp"
+
+using namespace YukiWorkshop;
+
+void GPIO::BitBangEngine::check_pin(int __idx) const {
+	if (__idx < 0 || __idx >= lines_.num_lines())
+		throw std::logic_error("pin index out of range");
+}
+
+void GPIO::BitBangEngine::play(uint64_t __payload_bits) {
+	samples_.clear();
+
+	uint64_t ioctls = 0;
+	uint64_t t0 = Utils::monotonic_ns();
+	uint64_t t = t0;
+
+	for (auto &it : steps_) {
+		if (!(it.flags & StepHold)) {
+			lines_.write_masked(it.bits, mask_);
+			ioctls++;
+		}
+
+		if ((it.flags & StepWaitClock) && stretch_timeout_ns_) {
+			uint64_t limit = Utils::monotonic_ns() + stretch_timeout_ns_;
+
+			while (ioctls++, !lines_.read_masked(clock_mask_)) {
+				if (Utils::monotonic_ns() > limit)
+					throw std::runtime_error("clock held low for too long");
+			}
+		}
+
+		if (it.delay_ns) {
+			// Delays count from when the step really happened, so a late step never shortens the next one
+			t = std::max(t, Utils::monotonic_ns()) + it.delay_ns;
+			Utils::sleep_until_ns(t, spin_ns_);
+		}
+
+		if (it.flags & StepSample) {
+			samples_.push_back(sample());
+			ioctls++;
+		}
+	}
+
+	stats_.bits += __payload_bits;
+	stats_.elapsed_ns += Utils::monotonic_ns() - t0;
+	stats_.ioctls += ioctls;
+}
+
+GPIO::SpiBitBang::SpiBitBang(const LineMultiple &__outputs, const SpiBitBangOptions &__options) :
+	BitBangEngine(__outputs), options_(__options) {
+	check_pin(options_.sck);
+	check_pin(options_.mosi);
+	if (options_.cs >= 0)
+		check_pin(options_.cs);
+
+	mask_ = bit(options_.sck) | bit(options_.mosi) | bit(options_.cs);
+
+	// Clock idle, chip deselected
+	lines_.write_masked((options_.cpol ? bit(options_.sck) : 0) | bit(options_.cs), mask_);
+}
+
+GPIO::SpiBitBang::SpiBitBang(const LineMultiple &__outputs, const LineSingle &__miso, const SpiBitBangOptions &__options) :
+	SpiBitBang(__outputs, __options) {
+	miso_ = __miso.duplicate();
+	has_miso_ = true;
+}
+
+uint8_t GPIO::SpiBitBang::sample() {
+	return miso_.read() ? 1 : 0;
+}
+
+void GPIO::SpiBitBang::transfer(const uint8_t *__tx, uint8_t *__rx, size_t __len) {
+	if (__rx && !has_miso_)
+		throw std::logic_error("no MISO line to receive on");
+
+	uint64_t idle = options_.cpol ? bit(options_.sck) : 0;
+	uint64_t active = options_.cpol ? 0 : bit(options_.sck);
+	uint64_t deselect = bit(options_.cs);
+	uint32_t h = options_.half_period_ns;
+	uint8_t fl = __rx ? StepSample : 0;
+
+	steps_.clear();
+
+	if (options_.cs >= 0)
+		push(idle, h);
+
+	for (size_t i=0; i<__len; i++) {
+		uint8_t byte = __tx ? __tx[i] : 0;
+
+		for (int b=0; b<8; b++) {
+			uint64_t d = (byte >> (options_.lsb_first ? b : 7 - b)) & 1 ? bit(options_.mosi) : 0;
+
+			// The data change rides on the clock edge that doesn't sample
+			if (!options_.cpha) {
+				push(idle | d, h);
+				push(active | d, h, fl);
+			} else {
+				push(active | d, h);
+				push(idle | d, h, fl);
+			}
+		}
+	}
+
+	if (!options_.cpha || options_.cs >= 0)
+		push(idle | deselect, 0);
+
+	play(__len * 8);
+
+	if (__rx) {
+		for (size_t i=0; i<__len; i++) {
+			uint8_t byte = 0;
+
+			for (int b=0; b<8; b++) {
+				if (samples_[i * 8 + b])
+					byte |= 1 << (options_.lsb_first ? b : 7 - b);
+			}
+
+			__rx[i] = byte;
+		}
+	}
+}
+
+GPIO::I2cBitBang::I2cBitBang(const LineMultiple &__lines, const I2cBitBangOptions &__options) :
+	BitBangEngine(__lines), options_(__options) {
+	check_pin(options_.scl);
+	check_pin(options_.sda);
+
+	if (options_.scl == options_.sda)
+		throw std::logic_error("SCL and SDA must be different lines");
+
+	mask_ = bit(options_.scl) | bit(options_.sda);
+	clock_mask_ = bit(options_.scl);
+	stretch_timeout_ns_ = options_.clock_stretch_timeout_ns;
+
+	// Release the bus
+	lines_.write_masked(mask_, mask_);
+}
+
+uint8_t GPIO::I2cBitBang::sample() {
+	return lines_.read_masked(bit(options_.sda)) ? 1 : 0;
+}
+
+void GPIO::I2cBitBang::clock(uint64_t __sda, uint8_t __flags) {
+	uint32_t h = options_.half_period_ns;
+	uint64_t scl = bit(options_.scl);
+
+	// SDA may only change while SCL is low. The GPIO driver is free to set
+	// the lines of one write in any order, so this can't share a write.
+	if (__sda != sda_state_) {
+		push(sda_state_, h / 2);
+		push(__sda, h - h / 2);
+	} else {
+		push(__sda, h);
+	}
+
+	push(__sda | scl, h, StepWaitClock | __flags);
+	sda_state_ = __sda;
+}
+
+void GPIO::I2cBitBang::start() {
+	uint32_t h = options_.half_period_ns;
+	uint64_t scl = bit(options_.scl), sda = bit(options_.sda);
+
+	// Repeated start: release SDA with SCL low, then raise SCL
+	if (active_) {
+		if (sda_state_ != sda)
+			push(sda_state_, h / 2);
+		push(sda, h - h / 2);
+		push(sda | scl, h, StepWaitClock);
+	}
+
+	push(scl, h);
+	push(0, h);
+
+	sda_state_ = 0;
+	active_ = true;
+}
+
+void GPIO::I2cBitBang::stop() {
+	uint32_t h = options_.half_period_ns;
+	uint64_t scl = bit(options_.scl), sda = bit(options_.sda);
+
+	if (sda_state_)
+		push(sda_state_, h / 2);
+	push(0, h - h / 2);
+	push(scl, h, StepWaitClock);
+	push(scl | sda, h);
+
+	sda_state_ = sda;
+	active_ = false;
+}
+
+void GPIO::I2cBitBang::put_byte(uint8_t __byte) {
+	uint64_t sda = bit(options_.sda);
+
+	for (int b=7; b>=0; b--)
+		clock((__byte >> b) & 1 ? sda : 0);
+
+	// Release SDA and sample the slave's ACK
+	clock(sda, StepSample);
+}
+
+void GPIO::I2cBitBang::get_byte(bool __ack) {
+	uint64_t sda = bit(options_.sda);
+
+	for (int b=0; b<8; b++)
+		clock(sda, StepSample);
+
+	clock(__ack ? 0 : sda);
+}
+
+bool GPIO::I2cBitBang::acked(size_t __from, size_t __count) const {
+	for (size_t i=__from; i<__from+__count; i++) {
+		if (samples_[i])
+			return false;
+	}
+
+	return true;
+}
+
+bool GPIO::I2cBitBang::write(uint8_t __addr, const uint8_t *__data, size_t __len) {
+	steps_.clear();
+	active_ = false;
+	sda_state_ = bit(options_.sda);
+
+	start();
+	put_byte(__addr << 1);
+	for (size_t i=0; i<__len; i++)
+		put_byte(__data[i]);
+	stop();
+
+	play((__len + 1) * 8);
+
+	return acked(0, __len + 1);
+}
+
+bool GPIO::I2cBitBang::read(uint8_t __addr, uint8_t *__data, size_t __len) {
+	return write_read(__addr, nullptr, 0, __data, __len);
+}
+
+bool GPIO::I2cBitBang::write_read(uint8_t __addr, const uint8_t *__tx, size_t __tx_len, uint8_t *__rx, size_t __rx_len) {
+	steps_.clear();
+	active_ = false;
+	sda_state_ = bit(options_.sda);
+
+	size_t acks = 0;
+
+	start();
+
+	if (__tx_len) {
+		put_byte(__addr << 1);
+		for (size_t i=0; i<__tx_len; i++)
+			put_byte(__tx[i]);
+		acks += __tx_len + 1;
+
+		start();
+	}
+
+	put_byte(__addr << 1 | 1);
+	acks++;
+
+	// The master ACKs every byte but the last
+	for (size_t i=0; i<__rx_len; i++)
+		get_byte(i + 1 < __rx_len);
+
+	stop();
+
+	play((acks + __rx_len) * 8);
+
+	// Samples are the write ACKs, then the read address ACK, then 8 per byte read
+	for (size_t i=0; i<__rx_len; i++) {
+		uint8_t byte = 0;
+
+		for (int b=0; b<8; b++)
+			byte = byte << 1 | samples_[acks + i * 8 + b];
+
+		__rx[i] = byte;
+	}
+
+	return acked(0, acks);
+}
+
+GPIO::OneWireBitBang::OneWireBitBang(const LineMultiple &__lines, int __pin) : BitBangEngine(__lines), pin_(__pin) {
+	check_pin(pin_);
+
+	mask_ = bit(pin_);
+	lines_.write_masked(mask_, mask_);
+}
+
+uint8_t GPIO::OneWireBitBang::sample() {
+	return lines_.read_masked(bit(pin_)) ? 1 : 0;
+}
+
+bool GPIO::OneWireBitBang::reset() {
+	steps_.clear();
+
+	push(0, 480000);
+	push(mask_, 70000, StepSample);
+	push(mask_, 410000, StepHold);
+
+	play(0);
+
+	return samples_[0] == 0;
+}
+
+void GPIO::OneWireBitBang::write(const uint8_t *__data, size_t __len) {
+	steps_.clear();
+
+	for (size_t i=0; i<__len; i++) {
+		for (int b=0; b<8; b++) {
+			if ((__data[i] >> b) & 1) {
+				push(0, 6000);
+				push(mask_, 64000);
+			} else {
+				push(0, 60000);
+				push(mask_, 10000);
+			}
+		}
+	}
+
+	play(__len * 8);
+}
+
+void GPIO::OneWireBitBang::read(uint8_t *__data, size_t __len) {
+	steps_.clear();
+
+	for (size_t i=0; i<__len; i++) {
+		for (int b=0; b<8; b++) {
+			push(0, 6000);
+			push(mask_, 9000, StepSample);
+			push(mask_, 55000, StepHold);
+		}
+	}
+
+	play(__len * 8);
+
+	for (size_t i=0; i<__len; i++) {
+		uint8_t byte = 0;
+
+		for (int b=0; b<8; b++)
+			byte |= samples_[i * 8 + b] << b;
+
+		__data[i] = byte;
+	}
+}
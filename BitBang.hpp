@@ -0,0 +1,183 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	struct BitBangStats {
+		// Payload bits moved, and the time it took
+		uint64_t bits = 0;
+		uint64_t elapsed_ns = 0;
+		uint64_t ioctls = 0;
+
+		// Achieved bus frequency in bits per second
+		double frequency() const noexcept {
+			return elapsed_ns ? bits * 1e9 / elapsed_ns : 0;
+		}
+	};
+
+	/*
+	 * Common player for the bit-bang engines below. A transfer is first
+	 * turned into a list of steps, then played back: every step that
+	 * changes pins is exactly one masked LineMultiple write, so clock and
+	 * data move together.
+	 */
+	class BitBangEngine {
+	protected:
+		enum StepFlags : uint8_t {
+			// Sample the input after the step's delay
+			StepSample = 1,
+			// Don't write, only wait
+			StepHold = 2,
+			// Wait for a released clock to actually go high (I2C clock stretching)
+			StepWaitClock = 4
+		};
+
+		struct Step {
+			uint64_t bits;
+			uint32_t delay_ns;
+			uint8_t flags;
+		};
+
+		LineMultiple lines_;
+		uint64_t mask_ = 0;
+		std::vector<Step> steps_;
+		std::vector<uint8_t> samples_;
+		BitBangStats stats_;
+
+		// Busy-wait delays shorter than this instead of sleeping
+		uint64_t spin_ns_ = 100000;
+		uint64_t stretch_timeout_ns_ = 0;
+		uint64_t clock_mask_ = 0;
+
+		explicit BitBangEngine(const LineMultiple& __lines) : lines_(__lines.duplicate()) {}
+		virtual ~BitBangEngine() = default;
+
+		void push(uint64_t __bits, uint32_t __delay_ns, uint8_t __flags = 0) {
+			steps_.push_back({__bits, __delay_ns, __flags});
+		}
+
+		uint64_t bit(int __idx) const noexcept {
+			return __idx < 0 ? 0 : 1ULL << __idx;
+		}
+
+		void check_pin(int __idx) const;
+
+		// Reads the data input, 0 or 1
+		virtual uint8_t sample() = 0;
+
+		// Plays steps_ into samples_, counting __payload_bits into the stats
+		void play(uint64_t __payload_bits);
+	public:
+		BitBangEngine(const BitBangEngine&) = delete;
+		BitBangEngine& operator=(const BitBangEngine&) = delete;
+
+		const BitBangStats& stats() const noexcept {
+			return stats_;
+		}
+
+		void reset_stats() noexcept {
+			stats_ = {};
+		}
+	};
+
+	struct SpiBitBangOptions {
+		// Pin indexes in the outputs LineMultiple, cs -1 for none
+		int sck = 0, mosi = 1, cs = -1;
+		// SPI mode bits
+		bool cpol = false, cpha = false;
+		bool lsb_first = false;
+		// 0 to run as fast as the ioctls go
+		uint32_t half_period_ns = 0;
+	};
+
+	class SpiBitBang : public BitBangEngine {
+	private:
+		SpiBitBangOptions options_;
+		LineSingle miso_;
+		bool has_miso_ = false;
+
+		uint8_t sample() override;
+	public:
+		// Outputs only
+		SpiBitBang(const LineMultiple& __outputs, const SpiBitBangOptions& __options = {});
+		SpiBitBang(const LineMultiple& __outputs, const LineSingle& __miso, const SpiBitBangOptions& __options = {});
+
+		// Full duplex, __rx may be null, and may be the same as __tx
+		void transfer(const uint8_t *__tx, uint8_t *__rx, size_t __len);
+	};
+
+	struct I2cBitBangOptions {
+		// Pin indexes in the LineMultiple, which must be requested as OpenDrain outputs
+		int scl = 0, sda = 1;
+		// 5000 for 100 kHz, 0 to run as fast as the ioctls go
+		uint32_t half_period_ns = 5000;
+		// Wait up to this long for a slave holding SCL low, 0 to not check SCL (saves one read per bit)
+		uint64_t clock_stretch_timeout_ns = 0;
+	};
+
+	/*
+	 * I2C master. A whole transaction is precomputed and played in one go,
+	 * so a NACK is only reported afterwards; the bytes after it are clocked
+	 * out anyway and ignored by the bus.
+	 */
+	class I2cBitBang : public BitBangEngine {
+	private:
+		I2cBitBangOptions options_;
+		// While building: whether a transaction is open, and the SDA value of the last step
+		bool active_ = false;
+		uint64_t sda_state_ = 0;
+
+		uint8_t sample() override;
+
+		void start();
+		void stop();
+		bool acked(size_t __from, size_t __count) const;
+		void put_byte(uint8_t __byte);
+		void get_byte(bool __ack);
+		void clock(uint64_t __sda, uint8_t __flags = 0);
+	public:
+		I2cBitBang(const LineMultiple& __lines, const I2cBitBangOptions& __options = {});
+
+		// These return false if any byte was not acknowledged
+		bool write(uint8_t __addr, const uint8_t *__data, size_t __len);
+		bool read(uint8_t __addr, uint8_t *__data, size_t __len);
+		// Write, repeated start, read, e.g. for register reads
+		bool write_read(uint8_t __addr, const uint8_t *__tx, size_t __tx_len, uint8_t *__rx, size_t __rx_len);
+	};
+
+	/*
+	 * 1-Wire master on one open-drain line, standard speed slot timings.
+	 */
+	class OneWireBitBang : public BitBangEngine {
+	private:
+		int pin_;
+
+		uint8_t sample() override;
+	public:
+		// __pin is the index of the data line in __lines, requested as an OpenDrain output
+		OneWireBitBang(const LineMultiple& __lines, int __pin = 0);
+
+		// True if a device answered with a presence pulse
+		bool reset();
+		void write(const uint8_t *__data, size_t __len);
+		void read(uint8_t *__data, size_t __len);
+	};
+}
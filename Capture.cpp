@@ -0,0 +1,267 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Capture.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace YukiWorkshop;
+
+static const char capture_magic[8] = {'G', 'P', 'I', 'O', 'C', 'A', 'P', 0};
+static const uint32_t capture_version = 1;
+static const size_t capture_header_size = 4096;
+static const uint32_t capture_escape = 127;
+static const uint64_t capture_delta_max = (1ULL << 56) - 1;
+
+static_assert(sizeof(GPIO::CaptureFileHeader) <= capture_header_size, "capture header too large");
+
+GPIO::CaptureWriter::CaptureWriter(const std::string &__path, const std::vector<uint32_t> &__lines, size_t __max_bytes,
+				   EventClock __clock, uint32_t __block_size) {
+	if (__lines.empty() || __lines.size() > 127)
+		throw std::logic_error("capture needs 1 to 127 lines");
+
+	if (!__block_size || __block_size % 4096)
+		throw std::logic_error("capture block size must be a multiple of 4096");
+
+	if (__max_bytes < capture_header_size + 2 * __block_size)
+		throw std::logic_error("capture file too small for two blocks");
+
+	uint64_t num_blocks = (__max_bytes - capture_header_size) / __block_size;
+	map_size_ = capture_header_size + num_blocks * __block_size;
+
+	fd_ = ::open(__path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd_ < 0)
+		throw ExceptionWithErrno("failed to create capture file");
+
+	if (ftruncate(fd_, map_size_)) {
+		close(fd_);
+		throw ExceptionWithErrno("failed to size capture file");
+	}
+
+	// Prefault now, so recording doesn't page fault
+	void *p = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, 0);
+	if (p == MAP_FAILED) {
+		close(fd_);
+		throw ExceptionWithErrno("failed to map capture file");
+	}
+
+	map_ = (uint8_t *)p;
+	hdr_ = (CaptureFileHeader *)map_;
+
+	memcpy(hdr_->magic, capture_magic, sizeof(capture_magic));
+	hdr_->version = capture_version;
+	hdr_->block_size = __block_size;
+	hdr_->num_blocks = num_blocks;
+	hdr_->num_lines = __lines.size();
+	hdr_->clock = (uint32_t)__clock;
+
+	uint32_t max_line = 0;
+	for (size_t i=0; i<__lines.size(); i++) {
+		hdr_->lines[i] = __lines[i];
+		max_line = std::max(max_line, __lines[i]);
+	}
+
+	index_.assign(max_line + 1, -1);
+	for (size_t i=0; i<__lines.size(); i++)
+		index_[__lines[i]] = i;
+
+	cap_words_ = (__block_size - sizeof(CaptureBlockHeader)) / 4;
+	open_block(0, 0);
+}
+
+GPIO::CaptureWriter::~CaptureWriter() {
+	msync(map_, map_size_, MS_SYNC);
+	munmap(map_, map_size_);
+	close(fd_);
+}
+
+void GPIO::CaptureWriter::open_block(uint64_t __number, uint64_t __ts) {
+	auto *b = map_ + capture_header_size + (__number % hdr_->num_blocks) * hdr_->block_size;
+
+	blk_ = (CaptureBlockHeader *)b;
+	words_ = (uint32_t *)(blk_ + 1);
+
+	blk_->count = 0;
+	blk_->base_ts = __ts;
+	blk_->seq = __number;
+	last_ts_ = __ts;
+
+	hdr_->current_block = __number;
+}
+
+void GPIO::CaptureWriter::append(uint32_t __index, bool __level, uint64_t __ts) {
+	// An empty block takes its base time from its first edge
+	if (!blk_->count) {
+		blk_->base_ts = __ts;
+		last_ts_ = __ts;
+	}
+
+	uint64_t delta = __ts - last_ts_;
+	uint32_t need = delta >> 24 ? 3 : 1;
+
+	if (delta > capture_delta_max || blk_->count + need > cap_words_) {
+		open_block(hdr_->current_block + 1, __ts);
+		delta = 0;
+		need = 1;
+	}
+
+	uint32_t c = blk_->count;
+
+	if (need == 3) {
+		words_[c++] = (uint32_t)(delta & 0xffffff) << 8 | capture_escape << 1;
+		words_[c++] = delta >> 24;
+		delta = 0;
+	}
+
+	words_[c++] = (uint32_t)delta << 8 | __index << 1 | __level;
+
+	// Publish the records before the count, for readers of a live file
+	__atomic_store_n(&blk_->count, c, __ATOMIC_RELEASE);
+	last_ts_ = __ts;
+}
+
+void GPIO::CaptureWriter::consume(const Event *__events, size_t __count) {
+	// One group is delivered by one thread, but a writer may be passed to several
+	// add_event() calls (or devices, or a Sampler) that run on different threads
+	std::lock_guard<std::mutex> lg(lock_);
+
+	uint64_t n = 0;
+
+	for (size_t i=0; i<__count; i++) {
+		auto &ev = __events[i];
+
+		if (ev.line >= index_.size() || index_[ev.line] < 0) {
+			ignored_.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		uint64_t ts = ev.timestamp;
+		if (ts < last_ts_) {
+			reordered_.fetch_add(1, std::memory_order_relaxed);
+			ts = last_ts_;
+		}
+
+		append(index_[ev.line], ev.type == EventType::RisingEdge, ts);
+		n++;
+	}
+
+	edges_.fetch_add(n, std::memory_order_relaxed);
+}
+
+void GPIO::CaptureWriter::flush() {
+	if (msync(map_, map_size_, MS_ASYNC))
+		throw ExceptionWithErrno("failed to flush capture file");
+}
+
+GPIO::CaptureReader::CaptureReader(const std::string &__path) {
+	fd_ = ::open(__path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd_ < 0)
+		throw ExceptionWithErrno("failed to open capture file");
+
+	struct stat st;
+	if (fstat(fd_, &st)) {
+		close(fd_);
+		throw ExceptionWithErrno("failed to stat capture file");
+	}
+
+	map_size_ = st.st_size;
+
+	if (map_size_ < capture_header_size) {
+		close(fd_);
+		throw std::runtime_error("not a capture file");
+	}
+
+	void *p = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd_, 0);
+	if (p == MAP_FAILED) {
+		close(fd_);
+		throw ExceptionWithErrno("failed to map capture file");
+	}
+
+	map_ = (const uint8_t *)p;
+	hdr_ = (const CaptureFileHeader *)map_;
+
+	// Checked like CaptureWriter makes them, and without overflowing: block() divides by
+	// num_blocks and trusts every block to be inside the mapping
+	if (memcmp(hdr_->magic, capture_magic, sizeof(capture_magic)) || hdr_->version != capture_version
+	    || hdr_->num_lines > 127 || !hdr_->block_size || hdr_->block_size % 4096 || !hdr_->num_blocks
+	    || hdr_->num_blocks > (map_size_ - capture_header_size) / hdr_->block_size) {
+		munmap((void *)map_, map_size_);
+		close(fd_);
+		throw std::runtime_error("not a capture file");
+	}
+}
+
+GPIO::CaptureReader::~CaptureReader() {
+	munmap((void *)map_, map_size_);
+	close(fd_);
+}
+
+const GPIO::CaptureBlockHeader *GPIO::CaptureReader::block(uint64_t __number) const noexcept {
+	auto *bh = (const CaptureBlockHeader *)(map_ + capture_header_size + (__number % hdr_->num_blocks) * hdr_->block_size);
+
+	// The writer may have moved on to this slot since current_block was read
+	return bh->seq == (uint32_t)__number ? bh : nullptr;
+}
+
+static std::string vcd_id(size_t __idx) {
+	std::string ret;
+
+	do {
+		ret += (char)('!' + __idx % 94);
+		__idx /= 94;
+	} while (__idx);
+
+	return ret;
+}
+
+void GPIO::CaptureReader::export_vcd(std::ostream &__out) const {
+	__out << "$timescale 1ns $end\n$scope module gpio $end\n";
+
+	std::vector<std::string> ids(hdr_->num_lines);
+	std::unordered_map<uint32_t, size_t> idx;
+
+	for (size_t i=0; i<hdr_->num_lines; i++) {
+		ids[i] = vcd_id(i);
+		idx[hdr_->lines[i]] = i;
+		__out << "$var wire 1 " << ids[i] << " line" << hdr_->lines[i] << " $end\n";
+	}
+
+	__out << "$upscope $end\n$enddefinitions $end\n#0\n$dumpvars\n";
+	for (auto &it : ids)
+		__out << "x" << it << "\n";
+	__out << "$end\n";
+
+	bool first = true;
+	uint64_t t0 = 0, last = 0;
+
+	for_each([&](const Event& __ev){
+		if (first) {
+			t0 = __ev.timestamp;
+			first = false;
+		}
+
+		uint64_t t = __ev.timestamp - t0;
+		if (t != last) {
+			__out << "#" << t << "\n";
+			last = t;
+		}
+
+		__out << (__ev.type == EventType::RisingEdge ? '1' : '0') << ids[idx[__ev.line]] << "\n";
+	});
+}
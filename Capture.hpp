@@ -0,0 +1,174 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <ostream>
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * Capture file layout: one page of CaptureFileHeader, then a ring of
+	 * fixed-size blocks. Each block starts with a CaptureBlockHeader holding
+	 * an absolute timestamp, followed by 32-bit records:
+	 *
+	 *   bit 0       level after the edge
+	 *   bits 1-7    index into CaptureFileHeader::lines, 127 = time escape
+	 *   bits 8-31   ns since the previous record in the block
+	 *
+	 * A time escape carries no edge, the word after it holds bits 24-55 of
+	 * the delta. When the file is full the oldest block is overwritten.
+	 */
+	struct CaptureFileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t block_size;
+		uint64_t num_blocks;
+		// Absolute number of the block being written, its slot is current_block % num_blocks
+		uint64_t current_block;
+		uint32_t num_lines;
+		uint32_t clock;
+		uint32_t lines[127];
+	};
+
+	struct CaptureBlockHeader {
+		uint64_t base_ts;
+		// Low 32 bits of the block's absolute number, to tell stale slots apart
+		uint32_t seq;
+		// Records (32-bit words) used
+		uint32_t count;
+	};
+
+	/*
+	 * Records the edges it is fed into a memory-mapped ring file. Nothing is
+	 * allocated per edge, and the file never grows past the size given.
+	 */
+	class CaptureWriter : public EventSink {
+	private:
+		int fd_ = -1;
+		uint8_t *map_ = nullptr;
+		size_t map_size_ = 0;
+
+		CaptureFileHeader *hdr_ = nullptr;
+		CaptureBlockHeader *blk_ = nullptr;
+		uint32_t *words_ = nullptr;
+		uint32_t cap_words_ = 0;
+		uint64_t last_ts_ = 0;
+
+		// Line offset -> index in the header, -1 if not captured
+		std::vector<int16_t> index_;
+
+		std::mutex lock_;
+		std::atomic<uint64_t> edges_{0}, ignored_{0}, reordered_{0};
+
+		void open_block(uint64_t __number, uint64_t __ts);
+		void append(uint32_t __index, bool __level, uint64_t __ts);
+	public:
+		// __max_bytes bounds the file size, including the header page
+		CaptureWriter(const std::string& __path, const std::vector<uint32_t>& __lines, size_t __max_bytes,
+			      EventClock __clock = EventClock::Monotonic, uint32_t __block_size = 4096);
+		~CaptureWriter() override;
+
+		CaptureWriter(const CaptureWriter&) = delete;
+		CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+		void consume(const Event *__events, size_t __count) override;
+
+		// Schedules writeback of everything recorded so far
+		void flush();
+
+		uint64_t edges() const noexcept {
+			return edges_.load(std::memory_order_relaxed);
+		}
+
+		// Events from lines not in the capture set
+		uint64_t ignored() const noexcept {
+			return ignored_.load(std::memory_order_relaxed);
+		}
+
+		// Events older than the previous one, recorded with a delta of 0
+		uint64_t reordered() const noexcept {
+			return reordered_.load(std::memory_order_relaxed);
+		}
+	};
+
+	class CaptureReader {
+	private:
+		int fd_ = -1;
+		const uint8_t *map_ = nullptr;
+		size_t map_size_ = 0;
+		const CaptureFileHeader *hdr_ = nullptr;
+
+		const CaptureBlockHeader *block(uint64_t __number) const noexcept;
+	public:
+		explicit CaptureReader(const std::string& __path);
+		~CaptureReader();
+
+		CaptureReader(const CaptureReader&) = delete;
+		CaptureReader& operator=(const CaptureReader&) = delete;
+
+		std::vector<uint32_t> lines() const {
+			return {hdr_->lines, hdr_->lines + hdr_->num_lines};
+		}
+
+		EventClock clock() const noexcept {
+			return (EventClock)hdr_->clock;
+		}
+
+		// Calls __func(const Event&) for every edge still in the file, oldest first
+		template <typename F>
+		void for_each(F __func) const {
+			uint64_t cur = hdr_->current_block;
+			uint64_t first = cur >= hdr_->num_blocks ? cur - hdr_->num_blocks + 1 : 0;
+
+			for (uint64_t b=first; b<=cur; b++) {
+				auto *bh = block(b);
+				if (!bh)
+					continue;
+
+				auto *w = reinterpret_cast<const uint32_t *>(bh + 1);
+				uint32_t cnt = std::min<uint32_t>(bh->count, (hdr_->block_size - sizeof(CaptureBlockHeader)) / 4);
+				uint64_t ts = bh->base_ts;
+
+				for (uint32_t i=0; i<cnt; i++) {
+					uint32_t idx = (w[i] >> 1) & 0x7f;
+					ts += w[i] >> 8;
+
+					if (idx == 127) {
+						if (++i < cnt)
+							ts += (uint64_t)w[i] << 24;
+						continue;
+					}
+
+					if (idx >= hdr_->num_lines)
+						continue;
+
+					Event ev{};
+					ev.type = (w[i] & 1) ? EventType::RisingEdge : EventType::FallingEdge;
+					ev.timestamp = ts;
+					ev.line = hdr_->lines[idx];
+					__func(ev);
+				}
+			}
+		}
+
+		// Value change dump with a 1 ns timescale, times relative to the first edge
+		void export_vcd(std::ostream& __out) const;
+	};
+}
@@ -0,0 +1,31 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ChipBackend.hpp"
+#include "DeviceIndex.hpp"
+
+using namespace YukiWorkshop;
+
+std::atomic<GPIO::ChipBackend *> GPIO::Sys::backend{nullptr};
+
+void GPIO::set_chip_backend(ChipBackend *__backend) {
+	Sys::backend.store(__backend);
+
+	// The index lists whatever chips the backend has
+	DeviceIndex::instance().invalidate();
+}
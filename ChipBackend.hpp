@@ -0,0 +1,83 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * The few syscalls that reach a GPIO chip or line handle: open, ioctl,
+	 * dup and close. Everything else (read, epoll, io_uring) works on the
+	 * fds these return, so a replacement must hand out real, pollable fds.
+	 *
+	 * Install one with set_chip_backend() before opening any device, e.g. a
+	 * SimBackend for tests and benchmarks without GPIO hardware. Fds a
+	 * backend doesn't know about should be passed through to the kernel.
+	 */
+	class ChipBackend {
+	public:
+		virtual ~ChipBackend() = default;
+
+		virtual int open(const char *__path, int __flags) = 0;
+		virtual int ioctl(int __fd, unsigned long __request, void *__arg) = 0;
+		virtual int dup(int __fd) = 0;
+		virtual int close(int __fd) = 0;
+
+		// Chip paths for the device index, the last component named like gpiochipN
+		virtual std::vector<std::string> chip_paths() = 0;
+	};
+
+	// nullptr goes back to the kernel. Only switch while no device or line handle is open.
+	extern void set_chip_backend(ChipBackend *__backend);
+
+	namespace Sys {
+		extern std::atomic<ChipBackend *> backend;
+
+		// The kernel path costs one relaxed load on top of the syscall
+		inline ChipBackend *current() noexcept {
+			return backend.load(std::memory_order_relaxed);
+		}
+
+		inline int open(const char *__path, int __flags) {
+			auto *b = current();
+			return b ? b->open(__path, __flags) : ::open(__path, __flags);
+		}
+
+		inline int ioctl(int __fd, unsigned long __request, void *__arg) {
+			auto *b = current();
+			return b ? b->ioctl(__fd, __request, __arg) : ::ioctl(__fd, __request, __arg);
+		}
+
+		inline int dup(int __fd) {
+			auto *b = current();
+			return b ? b->dup(__fd) : ::dup(__fd);
+		}
+
+		inline int close(int __fd) {
+			auto *b = current();
+			return b ? b->close(__fd) : ::close(__fd);
+		}
+	}
+}
@@ -0,0 +1,54 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+// The library itself stays C++17, only code including this header needs C++20
+#if __cplusplus < 202002L || !__has_include(<coroutine>)
+#error "GPIO++ coroutines need C++20"
+#endif
+
+#include <coroutine>
+#include <exception>
+
+#include "EdgeWatch.hpp"
+
+namespace YukiWorkshop::GPIO {
+	// Fire-and-forget coroutine: runs on the caller until its first co_await, then on the event loop
+	struct Task {
+		struct promise_type {
+			Task get_return_object() noexcept {
+				return {};
+			}
+
+			std::suspend_never initial_suspend() noexcept {
+				return {};
+			}
+
+			std::suspend_never final_suspend() noexcept {
+				return {};
+			}
+
+			void return_void() noexcept {}
+
+			void unhandled_exception() noexcept {
+				std::terminate();
+			}
+		};
+	};
+}
@@ -0,0 +1,140 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Counter.hpp"
+
+using namespace YukiWorkshop;
+
+// Step for (old state << 2) | new state, with state = (A << 1) | B.
+// 2 marks a transition that skipped a state.
+static const int8_t quadrature_steps[16] = {
+	0, -1, 1, 2,
+	1, 0, 2, -1,
+	-1, 2, 0, 1,
+	2, 1, -1, 0
+};
+
+static double rate(uint64_t __interval, uint64_t __last, uint64_t __now) {
+	if (!__interval)
+		return 0;
+
+	// Nothing for longer than the last interval, the rate can only be lower
+	if (__now > __last && __now - __last > __interval)
+		__interval = __now - __last;
+
+	return 1e9 / __interval;
+}
+
+void GPIO::PulseCounter::consume(const Event *__events, size_t __count) {
+	uint64_t cnt = count_.load(std::memory_order_relaxed);
+	uint64_t last = last_ts_.load(std::memory_order_relaxed);
+	uint64_t interval = 0;
+
+	for (size_t i=0; i<__count; i++) {
+		auto &ev = __events[i];
+
+		if (ev.line != line_ || !((int)mode_ & (int)ev.type))
+			continue;
+
+		if (last && ev.timestamp > last)
+			interval = ev.timestamp - last;
+
+		last = ev.timestamp;
+		cnt++;
+	}
+
+	if (interval)
+		interval_ns_.store(interval, std::memory_order_relaxed);
+	last_ts_.store(last, std::memory_order_relaxed);
+	count_.store(cnt, std::memory_order_release);
+}
+
+double GPIO::PulseCounter::frequency(uint64_t __now) const noexcept {
+	return rate(interval_ns_.load(std::memory_order_relaxed), last_ts_.load(std::memory_order_relaxed), __now);
+}
+
+GPIO::QuadratureEncoder::QuadratureEncoder(uint32_t __line_a, uint32_t __line_b, int __level_a, int __level_b) :
+	line_a_(__line_a), line_b_(__line_b) {
+	if (__line_a == __line_b)
+		throw std::logic_error("encoder needs two different lines");
+
+	if (__level_a >= 0) {
+		state_ |= (__level_a ? 2 : 0);
+		known_ |= 2;
+	}
+
+	if (__level_b >= 0) {
+		state_ |= (__level_b ? 1 : 0);
+		known_ |= 1;
+	}
+}
+
+void GPIO::QuadratureEncoder::consume(const Event *__events, size_t __count) {
+	uint64_t illegal = 0;
+	uint64_t last = last_ts_.load(std::memory_order_relaxed);
+	int64_t interval = 0;
+
+	for (size_t i=0; i<__count; i++) {
+		auto &ev = __events[i];
+		uint8_t bit;
+
+		if (ev.line == line_a_)
+			bit = 2;
+		else if (ev.line == line_b_)
+			bit = 1;
+		else
+			continue;
+
+		uint8_t next = ev.type == EventType::RisingEdge ? (state_ | bit) : (state_ & ~bit);
+
+		if (known_ != 3) {
+			known_ |= bit;
+			state_ = next;
+			continue;
+		}
+
+		// Same level again means the edge in between was lost
+		int step = next == state_ ? 2 : quadrature_steps[state_ << 2 | next];
+		state_ = next;
+
+		if (step == 2) {
+			illegal++;
+			continue;
+		}
+
+		pos_ += step;
+
+		if (last && ev.timestamp > last)
+			interval = step * (int64_t)(ev.timestamp - last);
+		last = ev.timestamp;
+	}
+
+	if (interval)
+		interval_ns_.store(interval, std::memory_order_relaxed);
+	last_ts_.store(last, std::memory_order_relaxed);
+	if (illegal)
+		illegal_.fetch_add(illegal, std::memory_order_relaxed);
+	position_.store(pos_, std::memory_order_release);
+}
+
+double GPIO::QuadratureEncoder::velocity(uint64_t __now) const noexcept {
+	int64_t interval = interval_ns_.load(std::memory_order_relaxed);
+	double r = rate(interval < 0 ? -interval : interval, last_ts_.load(std::memory_order_relaxed), __now);
+
+	return interval < 0 ? -r : r;
+}
@@ -0,0 +1,108 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * Counts edges of one line, e.g. from a flow meter. Pass it to
+	 * Device::add_event() as the sink; everything below can be read from
+	 * any thread without locking. Events of other lines are ignored.
+	 */
+	class PulseCounter : public EventSink {
+	private:
+		uint32_t line_;
+		EventMode mode_;
+
+		// Written by the delivering thread only
+		alignas(64) std::atomic<uint64_t> count_{0};
+		std::atomic<uint64_t> last_ts_{0};
+		std::atomic<uint64_t> interval_ns_{0};
+
+		// Written by reset() only
+		alignas(64) std::atomic<uint64_t> base_{0};
+	public:
+		// __mode picks which edges count, RisingEdge, FallingEdge or Both
+		explicit PulseCounter(uint32_t __line, EventMode __mode = EventMode::RisingEdge) : line_(__line), mode_(__mode) {}
+
+		void consume(const Event *__events, size_t __count) override;
+
+		uint64_t count() const noexcept {
+			return count_.load(std::memory_order_relaxed) - base_.load(std::memory_order_relaxed);
+		}
+
+		void reset() noexcept {
+			base_.store(count_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+
+		// Kernel timestamp of the last counted edge, 0 for none yet
+		uint64_t last_timestamp() const noexcept {
+			return last_ts_.load(std::memory_order_relaxed);
+		}
+
+		// From the last interval between counted edges. __now (CLOCK_MONOTONIC ns)
+		// lets a stopped input decay towards 0 instead of holding its last rate.
+		double frequency(uint64_t __now = 0) const noexcept;
+	};
+
+	/*
+	 * Decodes a quadrature encoder from the edges of its A and B lines.
+	 * Position counts every edge (4 per cycle), forward when A leads B.
+	 *
+	 * Both lines must be delivered by one thread: request them in the same
+	 * add_event() call, whose fds always share a listener thread.
+	 */
+	class QuadratureEncoder : public EventSink {
+	private:
+		uint32_t line_a_, line_b_;
+
+		// Delivering thread only: (A << 1) | B, and which of the two are known yet
+		uint8_t state_ = 0, known_ = 0;
+		int64_t pos_ = 0;
+
+		alignas(64) std::atomic<int64_t> position_{0};
+		std::atomic<uint64_t> illegal_{0};
+		std::atomic<uint64_t> last_ts_{0};
+		std::atomic<int64_t> interval_ns_{0};
+
+		alignas(64) std::atomic<int64_t> base_{0};
+	public:
+		// Pass the current levels if known, otherwise counting starts once both lines have moved
+		QuadratureEncoder(uint32_t __line_a, uint32_t __line_b, int __level_a = -1, int __level_b = -1);
+
+		void consume(const Event *__events, size_t __count) override;
+
+		int64_t position() const noexcept {
+			return position_.load(std::memory_order_relaxed) - base_.load(std::memory_order_relaxed);
+		}
+
+		void set_position(int64_t __pos) noexcept {
+			base_.store(position_.load(std::memory_order_relaxed) - __pos, std::memory_order_relaxed);
+		}
+
+		// Edges that don't fit the quadrature sequence, i.e. edges that were missed
+		uint64_t illegal_transitions() const noexcept {
+			return illegal_.load(std::memory_order_relaxed);
+		}
+
+		// Counts per second, negative when going backwards. See PulseCounter::frequency() for __now.
+		double velocity(uint64_t __now = 0) const noexcept;
+	};
+}
@@ -0,0 +1,181 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "DeviceIndex.hpp"
+#include "ChipBackend.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <system_error>
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <linux/gpio.h>
+
+using namespace YukiWorkshop;
+
+static const char dev_dir[] = "/dev";
+static const char chip_prefix[] = "gpiochip";
+
+GPIO::DeviceIndex::DeviceIndex() {
+	// Without inotify (e.g. no access to /dev) the index is simply never trusted
+	inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd_ != -1 && inotify_add_watch(inotify_fd_, dev_dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) == -1) {
+		close(inotify_fd_);
+		inotify_fd_ = -1;
+	}
+}
+
+GPIO::DeviceIndex::~DeviceIndex() {
+	if (inotify_fd_ != -1)
+		close(inotify_fd_);
+}
+
+GPIO::DeviceIndex &GPIO::DeviceIndex::instance() {
+	static DeviceIndex idx;
+	return idx;
+}
+
+bool GPIO::DeviceIndex::changed() {
+	if (inotify_fd_ == -1)
+		return true;
+
+	bool ret = false;
+	alignas(inotify_event) char buf[4096];
+	ssize_t rc;
+
+	while ((rc = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + rc; ) {
+			auto *ev = reinterpret_cast<inotify_event *>(p);
+
+			// The queue overflowed, anything may have happened
+			if ((ev->mask & IN_Q_OVERFLOW) || (ev->len && strncmp(ev->name, chip_prefix, sizeof(chip_prefix) - 1) == 0))
+				ret = true;
+
+			p += sizeof(inotify_event) + ev->len;
+		}
+	}
+
+	return ret;
+}
+
+static std::vector<std::string> scan_dev() {
+	std::vector<std::string> ret;
+
+	DIR *dir = opendir(dev_dir);
+	if (!dir)
+		throw ExceptionWithErrno("failed to open /dev");
+
+	while (auto *de = readdir(dir))
+		ret.emplace_back(std::string(dev_dir) + "/" + de->d_name);
+
+	closedir(dir);
+	return ret;
+}
+
+std::shared_ptr<const GPIO::DeviceIndex::Snapshot> GPIO::DeviceIndex::build() {
+	auto snap = std::make_shared<Snapshot>();
+
+	auto *backend = Sys::current();
+
+	for (auto &it : backend ? backend->chip_paths() : scan_dev()) {
+		auto slash = it.rfind('/');
+		const char *base = it.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+
+		if (strncmp(base, chip_prefix, sizeof(chip_prefix) - 1))
+			continue;
+
+		const char *num = base + sizeof(chip_prefix) - 1;
+		char *end;
+		unsigned long n = strtoul(num, &end, 10);
+		if (!*num || *end)
+			continue;
+
+		Chip c;
+		c.path = it;
+		c.number = n;
+		snap->chips.emplace_back(std::move(c));
+	}
+
+	std::sort(snap->chips.begin(), snap->chips.end(), [](const Chip& a, const Chip& b) {
+		return a.number < b.number;
+	});
+
+	for (auto it = snap->chips.begin(); it != snap->chips.end(); ) {
+		int fd = Sys::open(it->path.c_str(), O_RDWR | O_CLOEXEC);
+		gpiochip_info cinfo{};
+
+		// Gone since the scan, or not ours to open
+		if (fd == -1 || Sys::ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &cinfo)) {
+			if (fd != -1)
+				Sys::close(fd);
+			it = snap->chips.erase(it);
+			continue;
+		}
+
+		it->name = cinfo.name;
+		it->label = cinfo.label;
+		it->num_lines = cinfo.lines;
+		it->line_names.resize(cinfo.lines);
+
+		for (uint32_t i=0; i<cinfo.lines; i++) {
+			gpioline_info linfo{};
+			linfo.line_offset = i;
+
+			if (Sys::ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo) == 0)
+				it->line_names[i] = linfo.name;
+		}
+
+		Sys::close(fd);
+		++it;
+	}
+
+	for (size_t i=0; i<snap->chips.size(); i++) {
+		auto &c = snap->chips[i];
+
+		snap->chips_by_name.emplace(c.name, i);
+		snap->chips_by_label.emplace(c.label, i);
+
+		for (uint32_t j=0; j<c.num_lines; j++) {
+			if (!c.line_names[j].empty())
+				snap->lines.emplace(c.line_names[j], std::make_pair(i, j));
+		}
+	}
+
+	return snap;
+}
+
+std::shared_ptr<const GPIO::DeviceIndex::Snapshot> GPIO::DeviceIndex::snapshot() {
+	std::lock_guard<std::mutex> lg(lock_);
+
+	// inotify only covers /dev, other backends invalidate() when their chips change
+	if ((changed() && !Sys::current()) || !snapshot_)
+		snapshot_ = build();
+
+	return snapshot_;
+}
+
+void GPIO::DeviceIndex::invalidate() {
+	std::lock_guard<std::mutex> lg(lock_);
+	snapshot_.reset();
+}
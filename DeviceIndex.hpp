@@ -0,0 +1,77 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <cinttypes>
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * Process-wide index of GPIO chips and their line names. Built in one
+	 * pass, a directory scan of /dev plus one line info sweep per chip, and
+	 * rebuilt lazily after inotify reports gpiochip nodes coming or going.
+	 */
+	class DeviceIndex {
+	public:
+		struct Chip {
+			std::string path, name, label;
+			uint32_t number;
+			uint32_t num_lines;
+			// Indexed by line offset, empty strings for unnamed lines
+			std::vector<std::string> line_names;
+		};
+
+		struct Snapshot {
+			// In chip number order, gaps in the numbering are fine
+			std::vector<Chip> chips;
+			// Line name -> (index in chips, line offset). The lowest numbered chip wins on duplicates.
+			std::unordered_map<std::string, std::pair<size_t, uint32_t>> lines;
+			std::unordered_map<std::string, size_t> chips_by_name, chips_by_label;
+		};
+
+	private:
+		std::mutex lock_;
+		std::shared_ptr<const Snapshot> snapshot_;
+		int inotify_fd_ = -1;
+
+		DeviceIndex();
+
+		bool changed();
+		static std::shared_ptr<const Snapshot> build();
+	public:
+		~DeviceIndex();
+
+		DeviceIndex(const DeviceIndex&) = delete;
+		DeviceIndex& operator=(const DeviceIndex&) = delete;
+
+		static DeviceIndex& instance();
+
+		// The current index, rebuilt first if chips changed since the last call.
+		// Without inotify every call rebuilds.
+		std::shared_ptr<const Snapshot> snapshot();
+
+		// Forces a rebuild on the next snapshot(), e.g. after line names were changed
+		void invalidate();
+	};
+}
@@ -0,0 +1,118 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "EdgeFilter.hpp"
+
+using namespace YukiWorkshop;
+
+GPIO::EdgeFilter::EdgeFilter(const std::vector<uint32_t> &__lines, uint64_t __min_stable_ns, uint64_t __min_pulse_ns) :
+	hold_ns_(std::max(__min_stable_ns, __min_pulse_ns)) {
+	if (__lines.empty() || __lines.size() > 64)
+		throw std::logic_error("edge filter needs 1 to 64 lines");
+
+	uint32_t max_line = *std::max_element(__lines.begin(), __lines.end());
+	index_.assign(max_line + 1, UINT8_MAX);
+
+	lines_.resize(__lines.size());
+	for (size_t i=0; i<__lines.size(); i++) {
+		lines_[i].line = __lines[i];
+		index_[__lines[i]] = i;
+	}
+}
+
+void GPIO::EdgeFilter::emit(LineState &__s, Event *__out, size_t &__n) {
+	auto &ev = __out[__n++];
+	ev.type = __s.raw ? EventType::RisingEdge : EventType::FallingEdge;
+	ev.timestamp = __s.raw_ts;
+	ev.line = __s.line;
+	ev.seqno = __s.seqno;
+	ev.line_seqno = __s.line_seqno;
+
+	__s.reported = __s.raw;
+	__s.deadline = 0;
+}
+
+size_t GPIO::EdgeFilter::filter(const Event *__events, size_t __count, Event *__out) {
+	size_t n = 0;
+
+	for (size_t i=0; i<__count; i++) {
+		auto &ev = __events[i];
+
+		if (ev.line >= index_.size() || index_[ev.line] == UINT8_MAX)
+			continue;
+
+		auto &s = lines_[index_[ev.line]];
+
+		// The previous level lasted long enough before this edge came in
+		if (s.deadline && s.deadline <= ev.timestamp && s.raw != s.reported)
+			emit(s, __out, n);
+
+		bool level = ev.type == EventType::RisingEdge;
+
+		// Before its first edge the line must have been at the other level
+		if (!s.known) {
+			s.reported = !level;
+			s.known = true;
+		}
+
+		s.raw = level;
+		s.raw_ts = ev.timestamp;
+		s.seqno = ev.seqno;
+		s.line_seqno = ev.line_seqno;
+
+		// Back where it was last reported: a bounce or glitch, drop both edges
+		if (level == s.reported) {
+			s.deadline = 0;
+			continue;
+		}
+
+		if (hold_ns_)
+			s.deadline = ev.timestamp + hold_ns_;
+		else
+			emit(s, __out, n);
+	}
+
+	return n;
+}
+
+size_t GPIO::EdgeFilter::expire(uint64_t __now, Event *__out) {
+	size_t n = 0;
+
+	for (auto &s : lines_) {
+		if (!s.deadline || s.deadline > __now)
+			continue;
+
+		if (s.raw != s.reported)
+			emit(s, __out, n);
+		else
+			s.deadline = 0;
+	}
+
+	return n;
+}
+
+uint64_t GPIO::EdgeFilter::next_deadline() const noexcept {
+	uint64_t ret = 0;
+
+	for (auto &s : lines_) {
+		if (s.deadline && (!ret || s.deadline < ret))
+			ret = s.deadline;
+	}
+
+	return ret;
+}
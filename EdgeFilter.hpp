@@ -0,0 +1,76 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * Userspace debounce and glitch filter over kernel edge timestamps.
+	 *
+	 * min_stable_ns (debounce): a new level is only reported once it has
+	 * held that long, bounces before then are never seen.
+	 * min_pulse_ns (glitch filter): pulses shorter than that are dropped,
+	 * both of their edges.
+	 *
+	 * Both hold each edge until the new level has lasted the longer of the
+	 * two, and drop it if the line goes back before then. The reported
+	 * timestamp is the edge's own. A line that ends up at a new level is
+	 * always reported, when expire() is called past next_deadline().
+	 * Nothing is allocated after construction.
+	 */
+	class EdgeFilter {
+	private:
+		struct LineState {
+			uint32_t line = 0;
+			bool known = false;
+			bool raw = false, reported = false;
+			uint64_t raw_ts = 0;
+			uint32_t seqno = 0, line_seqno = 0;
+			// CLOCK_MONOTONIC time to look at this line again, 0 for none
+			uint64_t deadline = 0;
+		};
+
+		// How long a new level must last to be reported
+		uint64_t hold_ns_;
+		std::vector<LineState> lines_;
+		// Line offset -> index in lines_
+		std::vector<uint8_t> index_;
+
+		void emit(LineState& __s, Event *__out, size_t& __n);
+	public:
+		// At most 64 lines, like one kernel request
+		EdgeFilter(const std::vector<uint32_t>& __lines, uint64_t __min_stable_ns, uint64_t __min_pulse_ns);
+
+		// Filters __count raw events into __out, which must have room for 2 * __count.
+		// Returns how many passed.
+		size_t filter(const Event *__events, size_t __count, Event *__out);
+
+		// Reports lines whose wait ended by __now into __out, which must have room
+		// for one event per line. Returns how many.
+		size_t expire(uint64_t __now, Event *__out);
+
+		// Earliest time expire() has something to do, 0 for never
+		uint64_t next_deadline() const noexcept;
+
+		size_t num_lines() const noexcept {
+			return lines_.size();
+		}
+	};
+}
@@ -0,0 +1,240 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "EdgeWatch.hpp"
+
+#include <sys/timerfd.h>
+
+using namespace YukiWorkshop;
+
+GPIO::EdgeWatch::EdgeWatch(Device& __dev, uint32_t __line_number, LineMode __line_mode, EventMode __event_mode,
+			   const std::string& __label, const EventOptions& __options) : dev_(__dev), line_(__line_number) {
+	if ((timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+		throw ExceptionWithErrno("failed to create timerfd");
+
+	// Same shard for edges and timeouts, so one thread wakes this watch's waiters
+	EventOptions opts = __options;
+	if (opts.shard < 0)
+		opts.shard = __line_number;
+
+	try {
+		handle_ = dev_.add_event(__line_number, __line_mode, __event_mode, *this, __label, opts);
+	} catch (...) {
+		close(timerfd_);
+		throw;
+	}
+
+	timer_handle_ = dev_.add_fd_handler(timerfd_, [this](const uint8_t *, size_t) {
+		on_timer();
+	}, opts.shard);
+}
+
+GPIO::EdgeWatch::~EdgeWatch() {
+	// Device owns and closes both fds
+	dev_.remove_event(timer_handle_);
+	dev_.remove_event(handle_);
+}
+
+void GPIO::EdgeWatch::link(EdgeWaiter& __w) {
+	__w.prev = tail_;
+	__w.next = nullptr;
+
+	if (tail_)
+		tail_->next = &__w;
+	else
+		head_ = &__w;
+	tail_ = &__w;
+}
+
+void GPIO::EdgeWatch::unlink(EdgeWaiter& __w) {
+	if (__w.prev)
+		__w.prev->next = __w.next;
+	else
+		head_ = __w.next;
+
+	if (__w.next)
+		__w.next->prev = __w.prev;
+	else
+		tail_ = __w.prev;
+
+	__w.prev = __w.next = nullptr;
+}
+
+void GPIO::EdgeWatch::rearm_timer() {
+	uint64_t earliest = 0;
+
+	for (auto *w = head_; w; w = w->next) {
+		if (w->deadline && (!earliest || w->deadline < earliest))
+			earliest = w->deadline;
+	}
+
+	if (earliest == timer_deadline_)
+		return;
+
+	itimerspec its{};
+	its.it_value.tv_sec = earliest / 1000000000;
+	its.it_value.tv_nsec = earliest % 1000000000;
+
+	// A zero it_value disarms the timer
+	if (timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &its, nullptr))
+		throw ExceptionWithErrno("failed to arm timerfd");
+
+	timer_deadline_ = earliest;
+}
+
+uint8_t GPIO::EdgeWatch::read_value() {
+#ifdef GPIOPP_ABI_V2
+	if (dev_.abi_version() == 2) {
+		gpio_v2_line_values data{};
+		data.mask = 1;
+
+		if (GPIO::Sys::ioctl(handle_, GPIO_V2_LINE_GET_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to read value from line");
+
+		return data.bits & 1;
+	}
+#endif
+
+	gpiohandle_data data{};
+
+	if (GPIO::Sys::ioctl(handle_, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to read value from line");
+
+	return data.values[0];
+}
+
+uint8_t GPIO::EdgeWatch::value() {
+	return read_value();
+}
+
+void GPIO::EdgeWatch::add_waiter(EdgeWaiter& __w) {
+	std::unique_lock<std::mutex> lk(lock_);
+
+	__w.timed_out = false;
+	link(__w);
+
+	if (__w.deadline)
+		rearm_timer();
+}
+
+bool GPIO::EdgeWatch::add_level_waiter(EdgeWaiter& __w, uint8_t __value) {
+	std::unique_lock<std::mutex> lk(lock_);
+
+	// Read under the lock: an edge after this read can't be delivered before we're linked
+	if (read_value() == (__value ? 1 : 0))
+		return false;
+
+	__w.mode = __value ? EventMode::RisingEdge : EventMode::FallingEdge;
+	__w.timed_out = false;
+	link(__w);
+
+	if (__w.deadline)
+		rearm_timer();
+
+	return true;
+}
+
+bool GPIO::EdgeWatch::remove_waiter(EdgeWaiter& __w) {
+	std::unique_lock<std::mutex> lk(lock_);
+
+	for (auto *w = head_; w; w = w->next) {
+		if (w == &__w) {
+			unlink(__w);
+			rearm_timer();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void GPIO::EdgeWatch::consume(const Event *__events, size_t __count) {
+	for (size_t i=0; i<__count; i++) {
+		auto &ev = __events[i];
+		EdgeWaiter *ready = nullptr, *ready_tail = nullptr;
+
+		{
+			std::unique_lock<std::mutex> lk(lock_);
+
+			for (auto *w = head_; w;) {
+				auto *next = w->next;
+
+				if (static_cast<int>(w->mode) & static_cast<int>(ev.type)) {
+					unlink(*w);
+					w->event = ev;
+
+					if (ready_tail)
+						ready_tail->next = w;
+					else
+						ready = w;
+					ready_tail = w;
+				}
+
+				w = next;
+			}
+
+			if (ready)
+				rearm_timer();
+		}
+
+		// Resumed waiters may wait again right away and catch the next event of this batch
+		while (ready) {
+			auto *next = ready->next;
+			ready->next = nullptr;
+			ready->wake(ready);
+			ready = next;
+		}
+	}
+}
+
+void GPIO::EdgeWatch::on_timer() {
+	EdgeWaiter *ready = nullptr, *ready_tail = nullptr;
+
+	{
+		std::unique_lock<std::mutex> lk(lock_);
+
+		uint64_t now = Utils::monotonic_ns();
+
+		for (auto *w = head_; w;) {
+			auto *next = w->next;
+
+			if (w->deadline && w->deadline <= now) {
+				unlink(*w);
+				w->timed_out = true;
+
+				if (ready_tail)
+					ready_tail->next = w;
+				else
+					ready = w;
+				ready_tail = w;
+			}
+
+			w = next;
+		}
+
+		timer_deadline_ = 0;
+		rearm_timer();
+	}
+
+	while (ready) {
+		auto *next = ready->next;
+		ready->next = nullptr;
+		ready->wake(ready);
+		ready = next;
+	}
+}
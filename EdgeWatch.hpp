@@ -0,0 +1,202 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <optional>
+#include <chrono>
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	class EdgeWatch;
+	class EdgeAwaiter;
+	class EdgeTimeoutAwaiter;
+	class LevelAwaiter;
+
+	// Intrusive wait node, normally embedded in an awaiter (see Coroutine.hpp) so waiting allocates nothing
+	class EdgeWaiter {
+		friend class EdgeWatch;
+	private:
+		EdgeWaiter *prev = nullptr, *next = nullptr;
+	public:
+		EventMode mode = EventMode::Both;
+		// CLOCK_MONOTONIC deadline in ns, 0 for none
+		uint64_t deadline = 0;
+
+		Event event{};
+		bool timed_out = false;
+
+		// Called once, on the listener thread, after the waiter has been unlinked
+		void (*wake)(EdgeWaiter *) = nullptr;
+	};
+
+	/*
+	 * One watched input line with any number of waiters. Edges and timeouts
+	 * are delivered by the device's event loop (listener or dispatch_ready()),
+	 * there is no thread per waiter.
+	 */
+	class EdgeWatch : public EventSink {
+	private:
+		Device& dev_;
+		uint32_t line_;
+		int handle_ = -1;
+		int timer_handle_ = -1;
+		int timerfd_ = -1;
+		uint64_t timer_deadline_ = 0;
+
+		std::mutex lock_;
+		EdgeWaiter *head_ = nullptr, *tail_ = nullptr;
+
+		void link(EdgeWaiter& __w);
+		void unlink(EdgeWaiter& __w);
+		void rearm_timer();
+		void on_timer();
+		uint8_t read_value();
+
+	public:
+		EdgeWatch(Device& __dev, uint32_t __line_number, LineMode __line_mode = LineMode::Input,
+			  EventMode __event_mode = EventMode::Both, const std::string& __label = "", const EventOptions& __options = {});
+		~EdgeWatch() override;
+
+		EdgeWatch(const EdgeWatch&) = delete;
+		EdgeWatch& operator=(const EdgeWatch&) = delete;
+
+		uint32_t line() const noexcept {
+			return line_;
+		}
+
+		// Current line value, read from the event handle
+		uint8_t value();
+
+		void add_waiter(EdgeWaiter& __w);
+
+		// Returns false (and doesn't register) if the line already has __value
+		bool add_level_waiter(EdgeWaiter& __w, uint8_t __value);
+
+		// Returns false if __w already woke up
+		bool remove_waiter(EdgeWaiter& __w);
+
+		void consume(const Event *__events, size_t __count) override;
+
+		// co_await watch.edge(EventMode::RisingEdge) -> Event
+		EdgeAwaiter edge(EventMode __mode = EventMode::Both);
+
+		// co_await watch.edge_within(10ms) -> std::optional<Event>, empty on timeout
+		EdgeTimeoutAwaiter edge_within(std::chrono::nanoseconds __timeout, EventMode __mode = EventMode::Both);
+
+		// co_await watch.level(1) -> true once the line reads __value (at once if it already does)
+		LevelAwaiter level(uint8_t __value);
+
+		// -> false on timeout
+		LevelAwaiter level_within(uint8_t __value, std::chrono::nanoseconds __timeout);
+	};
+
+	/*
+	 * Awaiters for C++20 coroutines. They only touch the coroutine handle
+	 * through a template, so this header still builds as C++17. They live in
+	 * the coroutine frame: an await allocates nothing.
+	 */
+	class EdgeAwaiter : public EdgeWaiter {
+	protected:
+		EdgeWatch& watch_;
+		void *coro_ = nullptr;
+		void (*resume_)(void *) = nullptr;
+
+		static void wake_coro(EdgeWaiter *__w) {
+			auto *self = static_cast<EdgeAwaiter *>(__w);
+			self->resume_(self->coro_);
+		}
+
+		template <typename Handle>
+		void bind(Handle __h) {
+			coro_ = __h.address();
+			resume_ = [](void *__addr) {
+				Handle::from_address(__addr).resume();
+			};
+		}
+
+	public:
+		EdgeAwaiter(EdgeWatch& __watch, EventMode __mode, uint64_t __deadline = 0) : watch_(__watch) {
+			mode = __mode;
+			deadline = __deadline;
+			wake = &EdgeAwaiter::wake_coro;
+		}
+
+		bool await_ready() const noexcept {
+			return false;
+		}
+
+		template <typename Handle>
+		void await_suspend(Handle __h) {
+			bind(__h);
+			// May resume on the listener thread before this returns, don't touch *this afterwards
+			watch_.add_waiter(*this);
+		}
+
+		Event await_resume() const noexcept {
+			return event;
+		}
+	};
+
+	class EdgeTimeoutAwaiter : public EdgeAwaiter {
+	public:
+		using EdgeAwaiter::EdgeAwaiter;
+
+		std::optional<Event> await_resume() const noexcept {
+			if (timed_out)
+				return std::nullopt;
+			return event;
+		}
+	};
+
+	class LevelAwaiter : public EdgeAwaiter {
+	private:
+		uint8_t value_;
+	public:
+		LevelAwaiter(EdgeWatch& __watch, uint8_t __value, uint64_t __deadline = 0) :
+			EdgeAwaiter(__watch, EventMode::Both, __deadline), value_(__value) {}
+
+		template <typename Handle>
+		bool await_suspend(Handle __h) {
+			bind(__h);
+			// false: the line already has the value, carry on without suspending
+			return watch_.add_level_waiter(*this, value_);
+		}
+
+		bool await_resume() const noexcept {
+			return !timed_out;
+		}
+	};
+
+	inline EdgeAwaiter EdgeWatch::edge(EventMode __mode) {
+		return EdgeAwaiter(*this, __mode);
+	}
+
+	inline EdgeTimeoutAwaiter EdgeWatch::edge_within(std::chrono::nanoseconds __timeout, EventMode __mode) {
+		return EdgeTimeoutAwaiter(*this, __mode, Utils::monotonic_ns() + __timeout.count());
+	}
+
+	inline LevelAwaiter EdgeWatch::level(uint8_t __value) {
+		return LevelAwaiter(*this, __value);
+	}
+
+	inline LevelAwaiter EdgeWatch::level_within(uint8_t __value, std::chrono::nanoseconds __timeout) {
+		return LevelAwaiter(*this, __value, Utils::monotonic_ns() + __timeout.count());
+	}
+}
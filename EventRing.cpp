@@ -0,0 +1,96 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "EventRing.hpp"
+
+using namespace YukiWorkshop;
+
+GPIO::EventRing::EventRing(size_t __capacity, OverflowPolicy __policy) : policy_(__policy) {
+	size_t cap = 1;
+	while (cap < __capacity)
+		cap <<= 1;
+
+	buf_.resize(cap);
+	mask_ = cap - 1;
+}
+
+void GPIO::EventRing::consume(const Event *__events, size_t __count) {
+	uint64_t cap = buf_.size();
+	uint64_t head = head_.load(std::memory_order_relaxed);
+	uint64_t tail = tail_.load(std::memory_order_acquire);
+	uint64_t n = __count;
+
+	if (n > cap - (head - tail)) {
+		overflows_.fetch_add(1, std::memory_order_relaxed);
+
+		if (policy_ == OverflowPolicy::DropOldest) {
+			// Only the newest `cap' events of this batch can survive
+			if (n > cap) {
+				dropped_.fetch_add(n - cap, std::memory_order_relaxed);
+				__events += n - cap;
+				n = cap;
+			}
+
+			// The consumer may advance the tail concurrently, hence the CAS
+			while (n > cap - (head - tail)) {
+				uint64_t new_tail = head + n - cap;
+				if (tail_.compare_exchange_weak(tail, new_tail, std::memory_order_acq_rel, std::memory_order_acquire)) {
+					dropped_.fetch_add(new_tail - tail, std::memory_order_relaxed);
+					break;
+				}
+			}
+		} else {
+			uint64_t lost = n - (cap - (head - tail));
+			n -= lost;
+			dropped_.fetch_add(lost, std::memory_order_relaxed);
+
+			if (policy_ == OverflowPolicy::Report && overflow_handler_)
+				overflow_handler_(lost);
+		}
+	}
+
+	for (uint64_t i=0; i<n; i++)
+		buf_[(head + i) & mask_] = __events[i];
+
+	head_.store(head + n, std::memory_order_release);
+	pushed_.fetch_add(n, std::memory_order_relaxed);
+}
+
+size_t GPIO::EventRing::pop(Event *__out, size_t __max) {
+	uint64_t tail = tail_.load(std::memory_order_acquire);
+
+	while (true) {
+		uint64_t head = head_.load(std::memory_order_acquire);
+		size_t n = std::min<uint64_t>(head - tail, __max);
+
+		if (!n)
+			return 0;
+
+		for (size_t i=0; i<n; i++)
+			__out[i] = buf_[(tail + i) & mask_];
+
+		if (policy_ != OverflowPolicy::DropOldest) {
+			tail_.store(tail + n, std::memory_order_release);
+			return n;
+		}
+
+		// If the producer dropped events under us the copy may be torn, start over
+		if (tail_.compare_exchange_strong(tail, tail + n, std::memory_order_acq_rel, std::memory_order_acquire))
+			return n;
+	}
+}
@@ -0,0 +1,99 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	enum class OverflowPolicy : int {
+		// Keep what is queued, discard incoming events
+		DropNewest,
+		// Overwrite the oldest queued events
+		DropOldest,
+		// Like DropNewest, but call the overflow handler once per overflowing batch
+		Report
+	};
+
+	/*
+	 * Preallocated single-producer/single-consumer event queue. The listener
+	 * thread is the producer (pass the ring to Device::add_event), any one
+	 * other thread may pop().
+	 */
+	class EventRing : public EventSink {
+	private:
+		std::vector<Event> buf_;
+		uint64_t mask_;
+		OverflowPolicy policy_;
+		std::function<void(uint64_t)> overflow_handler_;
+
+		alignas(64) std::atomic<uint64_t> head_{0};
+		alignas(64) std::atomic<uint64_t> tail_{0};
+		alignas(64) std::atomic<uint64_t> pushed_{0};
+		std::atomic<uint64_t> dropped_{0};
+		std::atomic<uint64_t> overflows_{0};
+
+	public:
+		// __capacity is rounded up to a power of 2
+		explicit EventRing(size_t __capacity, OverflowPolicy __policy = OverflowPolicy::DropNewest);
+
+		EventRing(const EventRing&) = delete;
+		EventRing& operator=(const EventRing&) = delete;
+
+		// Called on the listener thread with the number of events lost, Report policy only
+		void set_overflow_handler(const std::function<void(uint64_t)>& __handler) {
+			overflow_handler_ = __handler;
+		}
+
+		void consume(const Event *__events, size_t __count) override;
+
+		// Copies up to __max events into __out, returns how many
+		size_t pop(Event *__out, size_t __max);
+
+		size_t capacity() const noexcept {
+			return buf_.size();
+		}
+
+		size_t size() const noexcept {
+			return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+		}
+
+		bool empty() const noexcept {
+			return size() == 0;
+		}
+
+		OverflowPolicy policy() const noexcept {
+			return policy_;
+		}
+
+		// Events accepted into the ring
+		uint64_t pushed() const noexcept {
+			return pushed_.load(std::memory_order_relaxed);
+		}
+
+		// Events lost to overflow, whichever end they were dropped from
+		uint64_t dropped() const noexcept {
+			return dropped_.load(std::memory_order_relaxed);
+		}
+
+		// Batches that didn't fit
+		uint64_t overflows() const noexcept {
+			return overflows_.load(std::memory_order_relaxed);
+		}
+	};
+}
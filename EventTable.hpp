@@ -0,0 +1,198 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+#include <cstddef>
+#include <cinttypes>
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * Dispatch table indexed directly by fd. Lookups are two atomic loads,
+	 * entering a read section is one increment on a per-thread counter.
+	 *
+	 * Writers must be serialized by the caller. Removed entries are retired
+	 * and only deleted after every read section that could have seen them
+	 * has ended (two-phase counter flip, like userspace RCU). That wait must
+	 * not hold anything a reader may need, so it is a separate step.
+	 */
+	template <typename T>
+	class EventTable {
+	public:
+		static constexpr size_t chunk_size = 1024;
+		static constexpr size_t max_chunks = 1024;
+		static constexpr size_t reader_slots = 16;
+
+		typedef std::vector<std::pair<int, T *>> Retired;
+
+		class ReadGuard {
+		private:
+			std::atomic<uint32_t> *counter;
+		public:
+			explicit ReadGuard(EventTable& __table) {
+				auto &rs = __table.readers[reader_slot()];
+				uint32_t epoch = __table.epoch.load();
+				counter = &rs.count[epoch & 1];
+				counter->fetch_add(1);
+				read_depth()++;
+			}
+
+			~ReadGuard() {
+				read_depth()--;
+				counter->fetch_sub(1, std::memory_order_release);
+			}
+
+			ReadGuard(const ReadGuard&) = delete;
+			ReadGuard& operator=(const ReadGuard&) = delete;
+		};
+
+	private:
+		struct Chunk {
+			std::atomic<T *> slots[chunk_size] = {};
+		};
+
+		struct alignas(64) ReaderSlot {
+			std::atomic<uint32_t> count[2] = {};
+		};
+
+		std::atomic<uint32_t> epoch{0};
+		ReaderSlot readers[reader_slots];
+		std::atomic<Chunk *> chunks[max_chunks] = {};
+		Retired retired;
+
+		static size_t reader_slot() {
+			static std::atomic<size_t> next{0};
+			thread_local size_t slot = next.fetch_add(1, std::memory_order_relaxed) % reader_slots;
+			return slot;
+		}
+
+		static unsigned& read_depth() {
+			thread_local unsigned depth = 0;
+			return depth;
+		}
+
+		void synchronize() {
+			for (int phase=0; phase<2; phase++) {
+				uint32_t old = epoch.fetch_add(1);
+				for (auto &it : readers) {
+					while (it.count[old & 1].load(std::memory_order_acquire))
+						std::this_thread::yield();
+				}
+			}
+		}
+
+	public:
+		EventTable() = default;
+
+		EventTable(const EventTable&) = delete;
+		EventTable& operator=(const EventTable&) = delete;
+
+		~EventTable() {
+			for (auto &it : chunks) {
+				auto *c = it.load(std::memory_order_relaxed);
+				if (c) {
+					for (auto &s : c->slots)
+						delete s.load(std::memory_order_relaxed);
+					delete c;
+				}
+			}
+
+			for (auto &it : retired)
+				delete it.second;
+		}
+
+		static constexpr bool in_range(int __fd) noexcept {
+			return __fd >= 0 && (size_t)__fd < chunk_size * max_chunks;
+		}
+
+		// Only valid inside a ReadGuard
+		T *load(int __fd) const noexcept {
+			if (!in_range(__fd))
+				return nullptr;
+
+			auto *c = chunks[__fd / chunk_size].load(std::memory_order_acquire);
+			return c ? c->slots[__fd % chunk_size].load(std::memory_order_acquire) : nullptr;
+		}
+
+		// Writer side. Takes ownership of __entry.
+		void insert(int __fd, T *__entry) {
+			if (!in_range(__fd)) {
+				delete __entry;
+				throw std::out_of_range("fd too large for event table");
+			}
+
+			auto &cp = chunks[__fd / chunk_size];
+			auto *c = cp.load(std::memory_order_relaxed);
+			if (!c) {
+				c = new Chunk;
+				cp.store(c, std::memory_order_release);
+			}
+
+			c->slots[__fd % chunk_size].store(__entry, std::memory_order_release);
+		}
+
+		// Writer side. The entry is unlinked at once; it is deleted and __on_reclaim(fd)
+		// is called after the grace period, see take_retired() and reclaim().
+		void remove(int __fd) {
+			if (!in_range(__fd))
+				return;
+
+			auto *c = chunks[__fd / chunk_size].load(std::memory_order_relaxed);
+			if (!c)
+				return;
+
+			T *old = c->slots[__fd % chunk_size].exchange(nullptr);
+			if (old)
+				retired.emplace_back(__fd, old);
+		}
+
+		// Whether the calling thread is inside a read section, where reclaim() would wait on itself
+		static bool in_read_section() noexcept {
+			return read_depth();
+		}
+
+		// Writer side. Hands over the entries removed so far, for reclaim().
+		Retired take_retired() {
+			Retired ret;
+			ret.swap(retired);
+			return ret;
+		}
+
+		// Waits for readers, then frees __batch. Call it outside of the writers' lock
+		// and of any read section, one thread at a time.
+		template <typename F>
+		void reclaim(Retired& __batch, F __on_reclaim) {
+			if (__batch.empty())
+				return;
+
+			synchronize();
+
+			for (auto &it : __batch) {
+				delete it.second;
+				__on_reclaim(it.first);
+			}
+			__batch.clear();
+		}
+	};
+}
@@ -17,96 +17,404 @@
 */
 
 #include "GPIO++.hpp"
+#include "IoUring.hpp"
+#include "EdgeFilter.hpp"
+#include "DeviceIndex.hpp"
+#include "LineInfoCache.hpp"
+
+#include <algorithm>
+#include <deque>
+
+#include <poll.h>
+#include <sys/timerfd.h>
 
 using namespace YukiWorkshop;
 
-std::vector<GPIO::Device> GPIO::all_devices() {
-	std::vector<GPIO::Device> ret;
+namespace {
+	void apply_default_bias(GPIO::LineMode& __mode) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+		if (!((__mode & GPIO::LineMode::PullUp) == GPIO::LineMode::PullUp || (__mode & GPIO::LineMode::PullDown) == GPIO::LineMode::PullDown)) {
+			__mode |= GPIO::LineMode::NoPull;
+		}
+#endif
+	}
 
-	for (uint32_t i=0; i<UINT32_MAX; i++) {
-		GPIO::Device d;
-		try {
-			d.open(i);
-			ret.emplace_back(std::move(d));
-		} catch (...) {
-			break;
+	int request_lines_v1(int __chip_fd, const GPIO::LineSpec *__lss, size_t __count, GPIO::LineMode __mode, const std::string& __label) {
+		gpiohandle_request req{};
+
+		for (size_t i=0; i<__count; i++) {
+			req.lineoffsets[i] = __lss[i].line_number;
+			req.default_values[i] = __lss[i].default_value;
+		}
+
+		req.flags = (uint32_t)__mode;
+		strncpy(req.consumer_label, __label.c_str(), 31);
+		req.lines = __count;
+
+		if (GPIO::Sys::ioctl(__chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req))
+			throw ExceptionWithErrno("failed to get line handle");
+
+		return req.fd;
+	}
+
+	uint64_t line_mask(size_t __count) {
+		return __count >= 64 ? UINT64_MAX : (1ULL << __count) - 1;
+	}
+
+	// Line info flags aren't request flags, map them back
+	GPIO::LineMode info_mode_v1(uint32_t __flags) {
+		static const std::pair<uint32_t, GPIO::LineMode> table[] = {
+			{GPIOLINE_FLAG_ACTIVE_LOW, GPIO::LineMode::ActiveLow},
+			{GPIOLINE_FLAG_OPEN_DRAIN, GPIO::LineMode::OpenDrain},
+			{GPIOLINE_FLAG_OPEN_SOURCE, GPIO::LineMode::OpenSource},
+#ifdef GPIOLINE_FLAG_BIAS_DISABLE
+			{GPIOLINE_FLAG_BIAS_DISABLE, GPIO::LineMode::NoPull},
+			{GPIOLINE_FLAG_BIAS_PULL_UP, GPIO::LineMode::PullUp},
+			{GPIOLINE_FLAG_BIAS_PULL_DOWN, GPIO::LineMode::PullDown},
+#endif
+		};
+
+		GPIO::LineMode ret = (__flags & GPIOLINE_FLAG_IS_OUT) ? GPIO::LineMode::Output : GPIO::LineMode::Input;
+		for (auto &it : table) {
+			if (__flags & it.first)
+				ret |= it.second;
+		}
+		return ret;
+	}
+
+	GPIO::LineInfo line_info_v1(const gpioline_info& __linfo) {
+		GPIO::LineInfo ret;
+		ret.offset = __linfo.line_offset;
+		ret.mode = info_mode_v1(__linfo.flags);
+		ret.used = __linfo.flags & GPIOLINE_FLAG_KERNEL;
+		strncpy(ret.name, __linfo.name, sizeof(ret.name)-1);
+		strncpy(ret.consumer, __linfo.consumer, sizeof(ret.consumer)-1);
+		return ret;
+	}
+
+#ifdef GPIOPP_ABI_V2
+	// Not every v2 header carries these
+	constexpr uint64_t v2_flag_event_clock_realtime = 1ULL << 11;
+	constexpr uint64_t v2_flag_event_clock_hte = 1ULL << 12;
+
+	uint64_t v2_flags(GPIO::LineMode __mode) {
+		static const std::pair<GPIO::LineMode, uint64_t> table[] = {
+			{GPIO::LineMode::Input, GPIO_V2_LINE_FLAG_INPUT},
+			{GPIO::LineMode::Output, GPIO_V2_LINE_FLAG_OUTPUT},
+			{GPIO::LineMode::ActiveLow, GPIO_V2_LINE_FLAG_ACTIVE_LOW},
+			{GPIO::LineMode::OpenDrain, GPIO_V2_LINE_FLAG_OPEN_DRAIN},
+			{GPIO::LineMode::OpenSource, GPIO_V2_LINE_FLAG_OPEN_SOURCE},
+			{GPIO::LineMode::NoPull, GPIO_V2_LINE_FLAG_BIAS_DISABLED},
+			{GPIO::LineMode::PullUp, GPIO_V2_LINE_FLAG_BIAS_PULL_UP},
+			{GPIO::LineMode::PullDown, GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN},
+		};
+
+		uint64_t ret = 0;
+		for (auto &it : table) {
+			if ((__mode & it.first) == it.first)
+				ret |= it.second;
+		}
+		return ret;
+	}
+
+	GPIO::LineMode v1_mode(uint64_t __flags) {
+		static const std::pair<uint64_t, GPIO::LineMode> table[] = {
+			{GPIO_V2_LINE_FLAG_INPUT, GPIO::LineMode::Input},
+			{GPIO_V2_LINE_FLAG_OUTPUT, GPIO::LineMode::Output},
+			{GPIO_V2_LINE_FLAG_ACTIVE_LOW, GPIO::LineMode::ActiveLow},
+			{GPIO_V2_LINE_FLAG_OPEN_DRAIN, GPIO::LineMode::OpenDrain},
+			{GPIO_V2_LINE_FLAG_OPEN_SOURCE, GPIO::LineMode::OpenSource},
+			{GPIO_V2_LINE_FLAG_BIAS_DISABLED, GPIO::LineMode::NoPull},
+			{GPIO_V2_LINE_FLAG_BIAS_PULL_UP, GPIO::LineMode::PullUp},
+			{GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN, GPIO::LineMode::PullDown},
+		};
+
+		GPIO::LineMode ret{};
+		for (auto &it : table) {
+			if (__flags & it.first)
+				ret |= it.second;
+		}
+		return ret;
+	}
+
+	GPIO::LineInfo line_info_v2(const gpio_v2_line_info& __linfo) {
+		GPIO::LineInfo ret;
+		ret.offset = __linfo.offset;
+		ret.mode = v1_mode(__linfo.flags);
+		ret.used = __linfo.flags & GPIO_V2_LINE_FLAG_USED;
+		strncpy(ret.name, __linfo.name, sizeof(ret.name)-1);
+		strncpy(ret.consumer, __linfo.consumer, sizeof(ret.consumer)-1);
+		return ret;
+	}
+
+	void v2_add_attr(gpio_v2_line_config& __config, const gpio_v2_line_attribute& __attr, uint64_t __mask) {
+		auto &ca = __config.attrs[__config.num_attrs++];
+		ca.attr = __attr;
+		ca.mask = __mask;
+	}
+
+	int request_lines_v2(int __chip_fd, const uint32_t *__offsets, size_t __count, uint64_t __flags, uint64_t __values,
+			     const std::string& __label, uint32_t __debounce_us = 0, uint32_t __buffer_size = 0) {
+		gpio_v2_line_request req{};
+
+		for (size_t i=0; i<__count; i++)
+			req.offsets[i] = __offsets[i];
+
+		req.num_lines = __count;
+		req.config.flags = __flags;
+		req.event_buffer_size = __buffer_size;
+		strncpy(req.consumer, __label.c_str(), GPIO_MAX_NAME_SIZE-1);
+
+		if (__values) {
+			gpio_v2_line_attribute attr{};
+			attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+			attr.values = __values;
+			v2_add_attr(req.config, attr, line_mask(__count));
+		}
+
+		if (__debounce_us) {
+			gpio_v2_line_attribute attr{};
+			attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+			attr.debounce_period_us = __debounce_us;
+			v2_add_attr(req.config, attr, line_mask(__count));
+		}
+
+		if (GPIO::Sys::ioctl(__chip_fd, GPIO_V2_GET_LINE_IOCTL, &req))
+			throw ExceptionWithErrno("failed to get line handle");
+
+		return req.fd;
+	}
+
+	int request_lines_v2(int __chip_fd, const GPIO::LineSpec *__lss, size_t __count, GPIO::LineMode __mode, const std::string& __label) {
+		uint32_t offsets[GPIO_V2_LINES_MAX];
+		uint64_t values = 0;
+
+		for (size_t i=0; i<__count; i++) {
+			offsets[i] = __lss[i].line_number;
+			if (__lss[i].default_value)
+				values |= 1ULL << i;
+		}
+
+		return request_lines_v2(__chip_fd, offsets, __count, v2_flags(__mode), values, __label);
+	}
+#endif
+
+	// False when the kernel can't reconfigure a request in place
+	bool set_line_config(int __line_fd, bool __v2, size_t __count, GPIO::LineMode __mode, uint64_t __values) {
+#ifdef GPIOPP_ABI_V2
+		if (__v2) {
+			gpio_v2_line_config config{};
+			config.flags = v2_flags(__mode);
+
+			if (__values) {
+				gpio_v2_line_attribute attr{};
+				attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+				attr.values = __values;
+				v2_add_attr(config, attr, line_mask(__count));
+			}
+
+			if (GPIO::Sys::ioctl(__line_fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config))
+				throw ExceptionWithErrno("failed to reconfigure line");
+
+			return true;
+		}
+#endif
+
+#ifdef GPIOHANDLE_SET_CONFIG_IOCTL
+		gpiohandle_config config{};
+		config.flags = (uint32_t)__mode;
+
+		for (size_t i=0; i<__count; i++)
+			config.default_values[i] = (__values >> i) & 1;
+
+		if (GPIO::Sys::ioctl(__line_fd, GPIOHANDLE_SET_CONFIG_IOCTL, &config) == 0)
+			return true;
+
+		// Kernels before 5.5 reject the unknown ioctl with EINVAL
+		if (errno != EINVAL && errno != ENOTTY)
+			throw ExceptionWithErrno("failed to reconfigure line");
+#endif
+
+		return false;
+	}
+
+	GPIO::LineInfo query_line_info(int __chip_fd, bool __v2, uint32_t __line) {
+#ifdef GPIOPP_ABI_V2
+		if (__v2) {
+			gpio_v2_line_info linfo{};
+			linfo.offset = __line;
+
+			if (GPIO::Sys::ioctl(__chip_fd, GPIO_V2_GET_LINEINFO_IOCTL, &linfo))
+				throw ExceptionWithErrno("failed to get line info");
+
+			return line_info_v2(linfo);
 		}
+#endif
+
+		gpioline_info linfo{};
+		linfo.line_offset = __line;
+
+		if (GPIO::Sys::ioctl(__chip_fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
+			throw ExceptionWithErrno("failed to get line info");
+
+		return line_info_v1(linfo);
 	}
+}
+
+std::vector<GPIO::Device> GPIO::all_devices() {
+	auto idx = DeviceIndex::instance().snapshot();
+
+	std::vector<GPIO::Device> ret;
+	ret.reserve(idx->chips.size());
+
+	for (auto &it : idx->chips)
+		ret.emplace_back(it.path);
 
 	return ret;
 }
 
 GPIO::Device GPIO::find_device_by_name(const std::string& __name) {
-	auto devs = all_devices();
+	auto idx = DeviceIndex::instance().snapshot();
 
-	for (auto &it : devs) {
-		if (it.name() == __name)
-			return it;
-	}
+	auto it = idx->chips_by_name.find(__name);
+	if (it == idx->chips_by_name.end())
+		throw std::logic_error("no device with this name");
 
-	throw std::logic_error("no device with this name");
+	return Device(idx->chips[it->second].path);
 }
 
 GPIO::Device GPIO::find_device_by_label(const std::string& __label) {
-	auto devs = all_devices();
+	auto idx = DeviceIndex::instance().snapshot();
 
-	for (auto &it : devs) {
-		if (it.label() == __label)
-			return it;
-	}
+	auto it = idx->chips_by_label.find(__label);
+	if (it == idx->chips_by_label.end())
+		throw std::logic_error("no device with this label");
+
+	return Device(idx->chips[it->second].path);
+}
+
+GPIO::LineLocation GPIO::find_line_by_name(const std::string& __name) {
+	auto idx = DeviceIndex::instance().snapshot();
+
+	auto it = idx->lines.find(__name);
+	if (it == idx->lines.end())
+		throw std::logic_error("no line with this name");
+
+	auto &chip = idx->chips[it->second.first];
+	return {chip.path, chip.number, it->second.second};
+}
+
+GPIO::Device::Device(Device &&other) {
+	*this = std::move(other);
+}
+
+GPIO::Device &GPIO::Device::operator=(Device &&other) {
+	if (this == &other)
+		return *this;
+
+	// Event fds are registered by fd in per-device tables and listener threads hold `this`
+	auto busy = [](Device& __d) {
+		std::unique_lock<std::mutex> lk(__d.event_lock);
+		return !__d.event_sources.empty() || !__d.listener_workers.empty() || __d.eventlistener_run;
+	};
+
+	if (busy(other) || busy(*this))
+		throw std::logic_error("can't move a device with events or a running listener");
+
+	if (fd != -1)
+		GPIO::Sys::close(fd);
+	if (poll_epfd != -1)
+		close(poll_epfd);
+
+	fd = other.fd;
+	poll_epfd = other.poll_epfd;
+	other.fd = -1;
+	other.poll_epfd = -1;
+
+	abi_version_ = other.abi_version_;
+	path_ = std::move(other.path_);
+	name_ = std::move(other.name_);
+	label_ = std::move(other.label_);
+	num_lines_ = other.num_lines_;
+	lines_by_num_ = std::move(other.lines_by_num_);
+	lines_by_name_ = std::move(other.lines_by_name_);
+	line_info_ = std::move(other.line_info_);
+	line_info_subs_ = std::move(other.line_info_subs_);
+	line_info_next_id_ = other.line_info_next_id_;
+	debug = other.debug;
+
+	return *this;
+}
+
+GPIO::Device::~Device() {
+	for (auto &it : event_sources)
+		events_table.remove(it.first);
+	reclaim_events();
 
-	throw std::logic_error("no device with this label");
+	// Line handles may outlive the device, they go back to asking the kernel
+	if (line_info_)
+		line_info_->set_watched(false);
+
+	if (fd != -1)
+		GPIO::Sys::close(fd);
+	if (poll_epfd != -1)
+		close(poll_epfd);
 }
 
 void GPIO::Device::get_device_info() {
 	gpiochip_info cinfo;
 
-	if (ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &cinfo)) {
+	if (GPIO::Sys::ioctl(fd, GPIO_GET_CHIPINFO_IOCTL, &cinfo)) {
 		throw ExceptionWithErrno("failed to get device info");
 	}
 
 	name_ = cinfo.name;
 	label_ = cinfo.label;
 	num_lines_ = cinfo.lines;
+
+	line_info_ = std::make_shared<LineInfoCache>(num_lines_);
 }
 
-std::map<uint32_t, std::string> &GPIO::Device::lines_by_num() {
-	if (lines_by_num_.empty()) {
-		for (uint32_t i=0; i<num_lines_; i++) {
-			gpioline_info linfo{};
-			linfo.line_offset = i;
+void GPIO::Device::load_line_names() {
+	std::map<uint32_t, std::string> by_num;
+	std::map<std::string, uint32_t> by_name;
 
-			if (ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
-				throw ExceptionWithErrno("failed to get line info");
+	// One sweep fills both maps
+	for (uint32_t i=0; i<num_lines_; i++) {
+		gpioline_info linfo{};
+		linfo.line_offset = i;
 
-			lines_by_num_.insert({i, linfo.name});
-		}
+		if (GPIO::Sys::ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
+			throw ExceptionWithErrno("failed to get line info");
+
+		by_num.insert({i, linfo.name});
+		by_name.insert({linfo.name, i});
 	}
 
-	return lines_by_num_;
+	lines_by_num_ = std::move(by_num);
+	lines_by_name_ = std::move(by_name);
 }
 
-std::map<std::string, uint32_t> &GPIO::Device::lines_by_name() {
-	if (lines_by_name_.empty()) {
-		for (uint32_t i=0; i<num_lines_; i++) {
-			gpioline_info linfo{};
-			linfo.line_offset = i;
+std::map<uint32_t, std::string> &GPIO::Device::lines_by_num() {
+	if (lines_by_num_.empty())
+		load_line_names();
 
-			if (ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
-				throw ExceptionWithErrno("failed to get line info");
+	return lines_by_num_;
+}
 
-			lines_by_name_.insert({linfo.name, i});
-		}
-	}
+std::map<std::string, uint32_t> &GPIO::Device::lines_by_name() {
+	if (lines_by_name_.empty())
+		load_line_names();
 
 	return lines_by_name_;
 }
 
 void GPIO::Device::open(const std::string &__path) {
-	if ((fd = ::open(__path.c_str(), O_RDWR)) == -1)
+	if ((fd = GPIO::Sys::open(__path.c_str(), O_RDWR)) == -1)
 		throw ExceptionWithErrno("failed to open device");
 
 	get_device_info();
+	detect_abi();
 	path_ = __path;
 
 	if (debug)
@@ -117,244 +425,1611 @@ void GPIO::Device::open(uint32_t __id) {
 	open(Utils::make_device_path(__id));
 }
 
-GPIO::LineSingle
-GPIO::Device::line(uint32_t __line_number, GPIO::LineMode __mode, uint8_t __default_value, const std::string &__label) {
-	gpiohandle_request req{};
+void GPIO::Device::detect_abi() {
+	abi_version_ = 1;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
-	if (!((__mode & LineMode::PullUp) == LineMode::PullUp || (__mode & LineMode::PullDown) == LineMode::PullDown)) {
-		__mode |= LineMode::NoPull;
+#ifdef GPIOPP_ABI_V2
+	if (num_lines_) {
+		gpio_v2_line_info linfo{};
+		linfo.offset = 0;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_GET_LINEINFO_IOCTL, &linfo) == 0)
+			abi_version_ = 2;
 	}
 #endif
+}
 
-	req.lineoffsets[0] = __line_number;
-	req.default_values[0] = __default_value;
-	req.flags = (uint32_t)__mode;
-	strncpy(req.consumer_label, __label.c_str(), 31);
-	req.lines = 1;
+GPIO::LineSingle
+GPIO::Device::line(uint32_t __line_number, GPIO::LineMode __mode, uint8_t __default_value, const std::string &__label) {
+	apply_default_bias(__mode);
+
+	LineSpec ls{__line_number, __default_value};
+	int lfd;
+	std::string lname, llabel;
 
-	if (ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req))
-		throw ExceptionWithErrno("failed to get line handle");
+	expect_line_changes(&__line_number, 1);
 
-	gpioline_info linfo{};
-	linfo.line_offset = __line_number;
+#ifdef GPIOPP_ABI_V2
+	if (abi_version_ == 2) {
+		lfd = request_lines_v2(fd, &ls, 1, __mode, __label);
+
+		gpio_v2_line_info linfo{};
+		linfo.offset = __line_number;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_GET_LINEINFO_IOCTL, &linfo)) {
+			GPIO::Sys::close(lfd);
+			throw ExceptionWithErrno("failed to get line info");
+		}
+
+		lname = linfo.name;
+		llabel = linfo.consumer;
+	} else
+#endif
+	{
+		lfd = request_lines_v1(fd, &ls, 1, __mode, __label);
+
+		gpioline_info linfo{};
+		linfo.line_offset = __line_number;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo)) {
+			GPIO::Sys::close(lfd);
+			throw ExceptionWithErrno("failed to get line info");
+		}
 
-	if (ioctl(fd, GPIO_GET_LINEINFO_IOCTL, &linfo))
-		throw ExceptionWithErrno("failed to get line info");
+		lname = linfo.name;
+		llabel = linfo.consumer;
+	}
 
 	if (debug)
 		std::cerr << "GPIO++: " << "Line " << __line_number << " opened, mode="
 			  << (uint)__mode << ", default_value=" << __default_value << ", label=" << __label << "\n";
 
-	return LineSingle(req.fd, fd, 1, linfo);
+	LineSingle ret(lfd, fd, __line_number, std::move(lname), std::move(llabel), abi_version_ == 2);
+	ret.info_ = line_info_;
+	ret.claim_ = claim_lines(&__line_number, 1);
+	return ret;
 }
 
 GPIO::LineMultiple
 GPIO::Device::line(const std::initializer_list<LineSpec> &__lss, GPIO::LineMode __mode, const std::string &__label) {
-	gpiohandle_request req{};
+	return line(__lss.begin(), __lss.size(), __mode, __label);
+}
 
-	uint8_t usable_size = __lss.size() > 64 ? 64 : __lss.size();
+GPIO::LineMultiple
+GPIO::Device::line(const std::vector<LineSpec> &__lss, GPIO::LineMode __mode, const std::string &__label) {
+	return line(__lss.data(), __lss.size(), __mode, __label);
+}
 
-	for (uint8_t i=0; i<usable_size; i++) {
-		req.lineoffsets[i] = (__lss.begin()+i)->line_number;
-		req.default_values[i] = (__lss.begin()+i)->default_value;
-	}
+GPIO::LineMultiple
+GPIO::Device::line(const LineSpec *__lss, size_t __count, GPIO::LineMode __mode, const std::string &__label) {
+	if (!__count)
+		throw std::logic_error("no lines requested");
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
-	if (!((__mode & LineMode::PullUp) == LineMode::PullUp || (__mode & LineMode::PullDown) == LineMode::PullDown)) {
-		__mode |= LineMode::NoPull;
-	}
-#endif
+	if (__count > max_lines_per_handle)
+		throw std::logic_error("too many lines for one handle, use line_group()");
 
-	strncpy(req.consumer_label, __label.c_str(), 31);
-	req.flags = (uint32_t)__mode;
-	req.lines = usable_size;
+	apply_default_bias(__mode);
+
+	uint32_t offsets[max_lines_per_handle];
+	for (size_t i=0; i<__count; i++)
+		offsets[i] = __lss[i].line_number;
 
-	if (ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &req))
-		throw ExceptionWithErrno("failed to get line handle");
+	expect_line_changes(offsets, __count);
+
+	int lfd;
+
+#ifdef GPIOPP_ABI_V2
+	if (abi_version_ == 2)
+		lfd = request_lines_v2(fd, __lss, __count, __mode, __label);
+	else
+#endif
+		lfd = request_lines_v1(fd, __lss, __count, __mode, __label);
 
 	if (debug)
-		for (uint8_t i=0; i<usable_size; i++) {
-			std::cerr << "GPIO++: " << "Line(M) " << (__lss.begin()+i)->line_number << " opened, mode="
-				  << (uint)__mode << ", default_value=" << (__lss.begin()+i)->default_value << "\n";
+		for (size_t i=0; i<__count; i++) {
+			std::cerr << "GPIO++: " << "Line(M) " << __lss[i].line_number << " opened, mode="
+				  << (uint)__mode << ", default_value=" << __lss[i].default_value << "\n";
 		}
 
+	LineMultiple ret(lfd, __count, abi_version_ == 2);
+	ret.claim_ = claim_lines(offsets, __count);
+	ret.pfd_ = fd;
+	ret.offsets_.assign(offsets, offsets + __count);
+	ret.label_ = __label;
+	ret.info_ = line_info_;
+	return ret;
+}
+
+GPIO::LineGroup
+GPIO::Device::line_group(const std::vector<LineSpec> &__lss, GPIO::LineMode __mode, const std::string &__label) {
+	LineGroup ret;
+
+	for (size_t i=0; i<__lss.size(); i+=max_lines_per_handle)
+		ret.add(line(__lss.data()+i, std::min(max_lines_per_handle, __lss.size()-i), __mode, __label));
 
-	return LineMultiple(req.fd, usable_size);
+	return ret;
 }
 
-int GPIO::Device::add_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
-			    const std::function<void(EventType, uint64_t)>& __handler, const std::string &__label) {
-	std::unique_lock<std::shared_mutex> lk(event_lock);
+int GPIO::Device::request_events(const std::vector<uint32_t>& __line_numbers, GPIO::LineMode __line_mode,
+				 GPIO::EventMode __event_mode, const EventOptions& __options, const std::string &__label) {
+#ifdef GPIOPP_ABI_V2
+	if (abi_version_ == 2) {
+		uint64_t flags = v2_flags(__line_mode) | GPIO_V2_LINE_FLAG_INPUT;
+
+		if ((__event_mode & EventMode::RisingEdge) == EventMode::RisingEdge)
+			flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+		if ((__event_mode & EventMode::FallingEdge) == EventMode::FallingEdge)
+			flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+		if (__options.clock == EventClock::Realtime)
+			flags |= v2_flag_event_clock_realtime;
+		else if (__options.clock == EventClock::HTE)
+			flags |= v2_flag_event_clock_hte;
+
+		if (__line_numbers.size() > GPIO_V2_LINES_MAX)
+			throw std::logic_error("too many lines in one event request");
+
+		return request_lines_v2(fd, __line_numbers.data(), __line_numbers.size(), flags, 0, __label,
+					__options.debounce_us, __options.buffer_size);
+	}
+#endif
+
+	if (__line_numbers.size() != 1)
+		throw std::logic_error("multi-line event requests need GPIO ABI v2");
+
+	if (__options.debounce_us || __options.clock != EventClock::Monotonic)
+		throw std::logic_error("event debounce and clock selection need GPIO ABI v2");
 
 	gpioevent_request req{};
-	req.lineoffset = __line_number;
+	req.lineoffset = __line_numbers[0];
 	req.handleflags = (uint32_t)__line_mode;
 	req.eventflags = (uint32_t)__event_mode;
 	strncpy(req.consumer_label, __label.c_str(), 31);
 
-	if (ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req)) {
+	if (GPIO::Sys::ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &req)) {
 		throw ExceptionWithErrno("failed to setup events");
 	}
 
-	events_map.insert({req.fd, __handler});
-
-	if (epfd > 0) {
-		epoll_event ev;
-		ev.events = EPOLLIN;
-		ev.data.fd = req.fd;
+	return req.fd;
+}
 
-		epoll_ctl(epfd, EPOLL_CTL_ADD, req.fd, &ev);
+struct GPIO::Device::FilterState {
+	EdgeFilter filter;
+	int timerfd = -1;
+	// Deadline the timer is set to, 0 when disarmed
+	uint64_t armed = 0;
+	// Edges the caller asked for, the kernel always delivers both
+	EventMode mode;
+	BatchEventHandler handler;
+	EventSink *sink;
+
+	FilterState(const std::vector<uint32_t>& __lines, EventMode __mode, const EventOptions& __options, const BatchEventHandler& __handler, EventSink *__sink) :
+		filter(__lines, __options.min_stable_ns, __options.min_pulse_ns), mode(__mode), handler(__handler), sink(__sink) {
+		// Closed by reclaim_events() once registered, like the event fd
+		if ((timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+			throw ExceptionWithErrno("failed to create timerfd");
 	}
+};
 
-	return req.fd;
+int GPIO::Device::add_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    const EventHandler& __handler, const std::string &__label, const EventOptions& __options) {
+	return add_event(std::vector<uint32_t>{__line_number}, __line_mode, __event_mode,
+			 [__handler](const Event *evs, size_t count) {
+				 for (size_t i=0; i<count; i++)
+					 __handler(evs[i].type, evs[i].timestamp);
+			 }, __label, __options);
 }
 
-void GPIO::Device::remove_event(int __event_handle) {
-	std::unique_lock<std::shared_mutex> lk(event_lock);
-
-	if (epfd > 0)
-		epoll_ctl(epfd, EPOLL_CTL_DEL, __event_handle, nullptr);
+int GPIO::Device::add_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    const BatchEventHandler& __handler, const std::string &__label, const EventOptions& __options) {
+	return add_event(std::vector<uint32_t>{__line_number}, __line_mode, __event_mode, __handler, __label, __options);
+}
 
-	events_map.erase(__event_handle);
+int GPIO::Device::add_event(const std::vector<uint32_t>& __line_numbers, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    const LineEventHandler& __handler, const std::string &__label, const EventOptions& __options) {
+	return add_event(__line_numbers, __line_mode, __event_mode,
+			 [__handler](const Event *evs, size_t count) {
+				 for (size_t i=0; i<count; i++)
+					 __handler(evs[i].line, evs[i].type, evs[i].timestamp);
+			 }, __label, __options);
 }
 
-void GPIO::Device::process_event(int __event_handle) {
-	std::shared_lock<std::shared_mutex> lk(event_lock);
+int GPIO::Device::add_event(const std::vector<uint32_t>& __line_numbers, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    const BatchEventHandler& __handler, const std::string &__label, const EventOptions& __options) {
+	return add_event(__line_numbers, __line_mode, __event_mode, __handler, nullptr, __label, __options);
+}
 
-	gpioevent_data event;
-	auto it = events_map.find(__event_handle);
-	if (it != events_map.end() &&
-	    read(__event_handle, &event, sizeof(gpioevent_data)) == sizeof(gpioevent_data))
-		events_map[__event_handle]((EventType)event.id, event.timestamp);
-	else
-		throw std::logic_error("event handle not found, check your code!");
+int GPIO::Device::add_event(uint32_t __line_number, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    EventSink& __sink, const std::string &__label, const EventOptions& __options) {
+	return add_event(std::vector<uint32_t>{__line_number}, __line_mode, __event_mode, nullptr, &__sink, __label, __options);
 }
 
-std::vector<int> GPIO::Device::event_fds() {
-	std::shared_lock<std::shared_mutex> lk(event_lock);
+int GPIO::Device::add_event(const std::vector<uint32_t>& __line_numbers, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    EventSink& __sink, const std::string &__label, const EventOptions& __options) {
+	return add_event(__line_numbers, __line_mode, __event_mode, nullptr, &__sink, __label, __options);
+}
 
-	std::vector<int> ret;
-	for (auto &it : events_map) {
-		ret.emplace_back(it.first);
+int GPIO::Device::add_event(const std::vector<uint32_t>& __line_numbers, GPIO::LineMode __line_mode, GPIO::EventMode __event_mode,
+			    BatchEventHandler __handler, EventSink *__sink, const std::string &__label, const EventOptions& __options) {
+	if (__line_numbers.empty())
+		throw std::logic_error("no lines to watch");
+
+	bool filtered = __options.min_stable_ns || __options.min_pulse_ns;
+
+	// The filter compares kernel timestamps against timerfd deadlines
+	if (filtered && __options.clock != EventClock::Monotonic)
+		throw std::logic_error("userspace event filtering needs the monotonic event clock");
+
+	std::unique_lock<std::mutex> lk(event_lock);
+
+	// One kernel request covers up to 64 lines on ABI v2, but only a single line on v1
+	bool v2 = abi_version_ == 2;
+	size_t chunk = v2 ? 64 : 1;
+	std::vector<std::vector<uint32_t>> chunks;
+	std::vector<int> efds;
+	std::vector<std::shared_ptr<FilterState>> filters;
+
+	try {
+		for (size_t i=0; i<__line_numbers.size(); i+=chunk) {
+			chunks.emplace_back(__line_numbers.begin()+i, __line_numbers.begin()+std::min(i+chunk, __line_numbers.size()));
+			expect_line_changes(chunks.back().data(), chunks.back().size());
+			// The filter tracks levels, so it has to see every edge
+			efds.emplace_back(request_events(chunks.back(), __line_mode, filtered ? EventMode::Both : __event_mode, __options, __label));
+
+			if (filtered) {
+				auto fs = std::make_shared<FilterState>(chunks.back(), __event_mode, __options, __handler, __sink);
+				filters.emplace_back(std::move(fs));
+			}
+		}
+	} catch (...) {
+		for (auto &it : efds)
+			GPIO::Sys::close(it);
+		for (auto &it : filters)
+			close(it->timerfd);
+		throw;
 	}
-	return ret;
-}
 
-bool GPIO::Device::is_event_fd(int __fd) {
-	std::shared_lock<std::shared_mutex> lk(event_lock);
+	int handle = efds[0];
 
-	return events_map.find(__fd) != events_map.end();
-}
+	for (size_t i=0; i<efds.size(); i++) {
+		uint32_t line = chunks[i][0];
 
-void GPIO::Device::run_eventlistener() {
-	eventlistener_run = true;
+		auto claim = claim_lines(chunks[i].data(), chunks[i].size());
+
+		if (!filtered) {
+			register_event_fd(efds[i], new EventEntry{__handler, __sink, line, v2, handle, nullptr, nullptr, claim}, {handle, line, __options.shard});
+			continue;
+		}
 
-	epfd = epoll_create(42);
+		// The filter timer joins the group, so edges and timeouts share a thread
+		auto fs = filters[i];
 
-	std::shared_lock<std::shared_mutex> lk(event_lock);
-	for (auto &it : events_map) {
-		epoll_event ev;
-		ev.events = EPOLLIN;
-		ev.data.fd = it.first;
+		auto *timer = new EventEntry;
+		timer->group = handle;
+		timer->fd_handler = [this, fs](const uint8_t *, size_t) {
+			filter_timer_expired(*fs);
+		};
 
-		epoll_ctl(epfd, EPOLL_CTL_ADD, it.first, &ev);
+		register_event_fd(efds[i], new EventEntry{__handler, __sink, line, v2, handle, nullptr, fs, claim}, {handle, line, __options.shard});
+		register_event_fd(fs->timerfd, timer, {handle, line, __options.shard});
 	}
+
 	lk.unlock();
+	reclaim_events();
 
-	int ep_rc;
-	epoll_event evs[16];
+	return handle;
+}
+
+std::shared_ptr<void> GPIO::Device::claim_lines(const uint32_t *__lines, size_t __count) {
+	auto cache = line_info_;
+	if (!cache)
+		return nullptr;
 
-	while ((ep_rc = epoll_wait(epfd, evs, 16, 1000)) != -1) {
-		if (ep_rc > 0) {
-			for (uint i=0; i<ep_rc; i++)
-				process_event(evs[i].data.fd);
+	std::vector<uint32_t> lines(__lines, __lines + __count);
+	for (auto it : lines)
+		cache->acquire(it);
+
+	// Runs right before the last handle closes the lines
+	return std::shared_ptr<void>(nullptr, [cache, lines](void *) {
+		for (auto it : lines) {
+			cache->expect_change(it);
+			cache->release(it);
 		}
+	});
+}
 
-		if (!eventlistener_run) {
-			close(epfd);
-			epfd = -1;
-			break;
+void GPIO::Device::expect_line_changes(const uint32_t *__lines, size_t __count) {
+	if (!line_info_)
+		return;
+
+	for (size_t i=0; i<__count; i++)
+		line_info_->expect_change(__lines[i]);
+}
+
+void GPIO::Device::watch_line_info() {
+#ifdef GPIOPP_HAVE_LINEINFO_WATCH
+	std::unique_lock<std::mutex> lk(event_lock);
+
+	if (line_info_fd_ != -1)
+		return;
+
+	if (fd == -1)
+		throw std::logic_error("device not opened");
+
+	// Watches belong to the open file, a fresh one keeps them and O_NONBLOCK off the chip fd
+	int wfd = GPIO::Sys::open(path_.c_str(), O_RDWR | O_CLOEXEC);
+	if (wfd == -1)
+		throw ExceptionWithErrno("failed to open device");
+
+	try {
+		// Each watch ioctl returns the line's info as of the moment the watch started
+		for (uint32_t i=0; i<num_lines_; i++) {
+#ifdef GPIOPP_ABI_V2
+			if (abi_version_ == 2) {
+				gpio_v2_line_info linfo{};
+				linfo.offset = i;
+
+				uint64_t ts = Utils::monotonic_ns();
+				if (GPIO::Sys::ioctl(wfd, GPIO_V2_GET_LINEINFO_WATCH_IOCTL, &linfo))
+					throw ExceptionWithErrno("failed to watch line info");
+
+				line_info_->store(line_info_v2(linfo), ts);
+				continue;
+			}
+#endif
+			gpioline_info linfo{};
+			linfo.line_offset = i;
+
+			uint64_t ts = Utils::monotonic_ns();
+			if (GPIO::Sys::ioctl(wfd, GPIO_GET_LINEINFO_WATCH_IOCTL, &linfo))
+				throw ExceptionWithErrno("failed to watch line info");
+
+			line_info_->store(line_info_v1(linfo), ts);
 		}
+	} catch (...) {
+		GPIO::Sys::close(wfd);
+		throw;
 	}
 
+	auto *entry = new EventEntry;
+	entry->group = wfd;
+	entry->fd_handler = [this](const uint8_t *__buf, size_t __len) {
+		line_info_changed(__buf, __len);
+	};
+
+	register_event_fd(wfd, entry, {wfd, 0, -1});
+	line_info_fd_ = wfd;
+	line_info_->set_watched(true);
+
+	if (debug)
+		std::cerr << "GPIO++: " << "Watching line info of " << num_lines_ << " lines on " << path_ << "\n";
+
+	lk.unlock();
+	reclaim_events();
+#else
+	throw std::logic_error("line info watches need Linux 5.7+ headers");
+#endif
 }
 
-void GPIO::Device::stop_eventlistener() {
-	eventlistener_run = false;
+bool GPIO::Device::line_info_watched() const noexcept {
+	return line_info_ && line_info_->watched();
 }
 
-uint8_t GPIO::LineSingle::read() {
-	gpiohandle_data data{};
+void GPIO::Device::line_info_changed(const uint8_t *__buf, size_t __len) {
+#ifdef GPIOPP_HAVE_LINEINFO_WATCH
+	auto subs = std::atomic_load(&line_info_subs_);
 
-	if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data))
-		throw ExceptionWithErrno("failed to read value from line");
+	auto apply = [&](const LineInfo& __info, uint32_t __type, uint64_t __ts) {
+		line_info_->store(__info, __ts);
 
-	if (debug)
-		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value read: " << +data.values[0] << "\n";
+		if (debug)
+			std::cerr << "GPIO++: " << "Line " << __info.offset << " info changed, type=" << __type
+				  << ", consumer=" << __info.consumer << "\n";
+
+		if (subs) {
+			for (auto &it : *subs)
+				it.second(__info, (LineInfoChange)__type, __ts);
+		}
+	};
+
+#ifdef GPIOPP_ABI_V2
+	if (abi_version_ == 2) {
+		for (size_t off=0; off + sizeof(gpio_v2_line_info_changed) <= __len; off += sizeof(gpio_v2_line_info_changed)) {
+			gpio_v2_line_info_changed chg;
+			memcpy(&chg, __buf + off, sizeof(chg));
+			apply(line_info_v2(chg.info), chg.event_type, chg.timestamp_ns);
+		}
+		return;
+	}
+#endif
 
-	return data.values[0];
+	for (size_t off=0; off + sizeof(gpioline_info_changed) <= __len; off += sizeof(gpioline_info_changed)) {
+		gpioline_info_changed chg;
+		memcpy(&chg, __buf + off, sizeof(chg));
+		apply(line_info_v1(chg.info), chg.event_type, chg.timestamp);
+	}
+#endif
 }
 
-void GPIO::LineSingle::write(uint8_t __value) {
-	gpiohandle_data data{};
-	data.values[0] = __value;
+GPIO::LineInfo GPIO::Device::line_info(uint32_t __line) {
+	LineInfo ret;
 
-	if (ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data))
-		throw ExceptionWithErrno("failed to write value to line");
+	if (line_info_watched()) {
+		if (__line >= num_lines_)
+			throw std::out_of_range("line number out of range");
+		if (line_info_->load(__line, ret))
+			return ret;
+	}
 
-	if (debug)
-		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value write: " << +data.values[0] << "\n";
+	// Not watched, or a change of ours the watch hasn't caught up with yet
+	return query_line_info(fd, abi_version_ == 2, __line);
 }
 
-GPIO::LineMode GPIO::LineSingle::mode() const {
-	gpioline_info linfo{};
-	linfo.line_offset = offset_;
+bool GPIO::Device::requested_elsewhere(uint32_t __line) {
+	return line_info(__line).used && !(line_info_ && line_info_->owned(__line));
+}
+
+int GPIO::Device::subscribe_line_info(const LineInfoHandler& __handler) {
+	std::unique_lock<std::mutex> lk(line_info_lock);
 
-	if (ioctl(pfd, GPIO_GET_LINEINFO_IOCTL, &linfo))
-		throw ExceptionWithErrno("failed to get line info");
+	auto subs = line_info_subs_ ? std::make_shared<LineInfoSubscribers>(*line_info_subs_) : std::make_shared<LineInfoSubscribers>();
+	int id = line_info_next_id_++;
+	subs->emplace_back(id, __handler);
 
-	return (LineMode)linfo.flags;
+	std::atomic_store(&line_info_subs_, std::shared_ptr<const LineInfoSubscribers>(std::move(subs)));
+	return id;
 }
 
-void GPIO::LineSingle::set_mode(GPIO::LineMode __mode, uint8_t __default_value, const std::string &__label) {
-	close(fd);
+void GPIO::Device::unsubscribe_line_info(int __id) {
+	std::unique_lock<std::mutex> lk(line_info_lock);
 
-	gpiohandle_request req{};
+	if (!line_info_subs_)
+		return;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
-	if (!((__mode & LineMode::PullUp) == LineMode::PullUp || (__mode & LineMode::PullDown) == LineMode::PullDown)) {
-		__mode |= LineMode::NoPull;
+	auto subs = std::make_shared<LineInfoSubscribers>();
+	for (auto &it : *line_info_subs_) {
+		if (it.first != __id)
+			subs->push_back(it);
 	}
-#endif
 
-	req.lineoffsets[0] = offset_;
-	req.default_values[0] = __default_value;
-	req.flags = (uint32_t)__mode;
-	strncpy(req.consumer_label, __label.c_str(), 31);
-	req.lines = 1;
+	std::atomic_store(&line_info_subs_, std::shared_ptr<const LineInfoSubscribers>(std::move(subs)));
+}
 
-	if (ioctl(pfd, GPIO_GET_LINEHANDLE_IOCTL, &req))
-		throw ExceptionWithErrno("failed to get line handle");
+int GPIO::Device::add_fd_handler(int __fd, const FdHandler& __handler, int __shard) {
+	std::unique_lock<std::mutex> lk(event_lock);
 
-	if (debug)
-		std::cerr << "GPIO++: " << "Line " << number() << ": mode changed, mode="
-			  << (uint)__mode << ", default_value=" << __default_value << ", label=" << __label << "\n";
+	auto *entry = new EventEntry;
+	entry->group = __fd;
+	entry->fd_handler = __handler;
+
+	register_event_fd(__fd, entry, {__fd, 0, __shard});
+
+	lk.unlock();
+	reclaim_events();
 
-	fd = req.fd;
+	return __fd;
 }
 
-std::vector<uint8_t> GPIO::LineMultiple::read() {
-	std::vector<uint8_t> ret(sizeof(gpiohandle_data));
+void GPIO::Device::register_event_fd(int __fd, EventEntry *__entry, const EventSource& __src) {
+	// Dispatch must never block, whoever calls it
+	fcntl(__fd, F_SETFL, fcntl(__fd, F_GETFL) | O_NONBLOCK);
 
-	if (ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, ret.data()))
-		throw ExceptionWithErrno("failed to read values from lines");
+	events_table.insert(__fd, __entry);
+	auto &src = event_sources[__fd];
+	src = __src;
 
-	ret.resize(size);
-	return ret;
+	if (!listener_workers.empty())
+		listener_attach(__fd, src);
+
+	if (poll_epfd != -1) {
+		epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.fd = __fd;
+
+		epoll_ctl(poll_epfd, EPOLL_CTL_ADD, __fd, &ev);
+	}
 }
 
-void GPIO::LineMultiple::write(const std::vector<uint8_t> &__values) {
-	if (ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, __values.data()))
-		throw ExceptionWithErrno("failed to write values to lines");
+void GPIO::Device::remove_event(int __event_handle) {
+	std::unique_lock<std::mutex> lk(event_lock);
+
+	for (auto it = event_sources.begin(); it != event_sources.end();) {
+		if (it->second.group == __event_handle) {
+			if (!listener_workers.empty())
+				listener_detach(it->first, it->second);
+			if (poll_epfd != -1)
+				epoll_ctl(poll_epfd, EPOLL_CTL_DEL, it->first, nullptr);
+
+			events_table.remove(it->first);
+			it = event_sources.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	listener_group_shards.erase(__event_handle);
+
+	lk.unlock();
+	reclaim_events();
+}
+
+void GPIO::Device::reclaim_events() {
+	// A handler removing itself would wait for its own read section, the next call from outside picks it up
+	if (EventTable<EventEntry>::in_read_section())
+		return;
+
+	std::unique_lock<std::mutex> rlk(reclaim_lock);
+
+	EventTable<EventEntry>::Retired batch;
+	{
+		std::unique_lock<std::mutex> lk(event_lock);
+		batch = events_table.take_retired();
+	}
+
+	// fds are closed only after the grace period, so their numbers can't be reused under a reader
+	events_table.reclaim(batch, [](int __fd) {
+		GPIO::Sys::close(__fd);
+	});
+}
+
+size_t GPIO::Device::process_event(int __event_handle) {
+	return dispatch_event(__event_handle, true);
+}
+
+int GPIO::Device::poll_fd() {
+	std::unique_lock<std::mutex> lk(event_lock);
+
+	if (poll_epfd == -1) {
+		if ((poll_epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+			throw ExceptionWithErrno("failed to create epoll instance");
+
+		for (auto &it : event_sources) {
+			epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.fd = it.first;
+
+			epoll_ctl(poll_epfd, EPOLL_CTL_ADD, it.first, &ev);
+		}
+	}
+
+	return poll_epfd;
+}
+
+size_t GPIO::Device::dispatch_ready(size_t __max_events) {
+	int epfd = poll_fd();
+	size_t total = 0;
+	epoll_event evs[16];
+	int ep_rc;
+
+	while (total < __max_events && (ep_rc = epoll_wait(epfd, evs, 16, 0)) > 0) {
+		for (int i=0; i<ep_rc && total < __max_events; i++)
+			total += dispatch_event(evs[i].data.fd, false, std::min(__max_events - total, event_batch_size));
+	}
+
+	return total;
+}
+
+size_t GPIO::Device::dispatch_event(int __event_handle, bool __must_exist, size_t __max_events) {
+	EventTable<EventEntry>::ReadGuard rg(events_table);
+
+	auto *e = events_table.load(__event_handle);
+	if (!e) {
+		// The listener may still see an fd that was removed while it was waiting
+		if (!__must_exist)
+			return 0;
+		throw std::logic_error("event handle not found, check your code!");
+	}
+
+	// Drain everything the kernel has queued for this handle in one go
+	alignas(8) uint8_t buf[event_read_size];
+#ifdef GPIOPP_ABI_V2
+	size_t record_size = e->v2 ? sizeof(gpio_v2_line_event) : sizeof(gpioevent_data);
+#else
+	size_t record_size = sizeof(gpioevent_data);
+#endif
+	size_t read_size = e->fd_handler ? event_read_size : std::min(__max_events, event_batch_size) * record_size;
+
+	ssize_t rc = read(__event_handle, buf, read_size);
+	if (rc == -1 && errno == EAGAIN)
+		return 0;
+	if (rc < 1 || (!e->fd_handler && rc < (ssize_t)record_size))
+		throw ExceptionWithErrno("failed to read events");
+
+	return deliver_events(*e, buf, rc);
+}
+
+size_t GPIO::Device::deliver_events(EventEntry& __entry, const uint8_t *__buf, size_t __len) {
+	if (__entry.fd_handler) {
+		__entry.fd_handler(__buf, __len);
+		return 1;
+	}
+
+	Event evs[event_batch_size];
+	size_t count;
+
+#ifdef GPIOPP_ABI_V2
+	if (__entry.v2) {
+		auto *records = reinterpret_cast<const gpio_v2_line_event *>(__buf);
+		count = std::min(__len / sizeof(gpio_v2_line_event), event_batch_size);
+		for (size_t i=0; i<count; i++)
+			evs[i] = {(EventType)records[i].id, records[i].timestamp_ns, records[i].offset, records[i].seqno, records[i].line_seqno};
+	} else
+#endif
+	{
+		auto *records = reinterpret_cast<const gpioevent_data *>(__buf);
+		count = std::min(__len / sizeof(gpioevent_data), event_batch_size);
+		for (size_t i=0; i<count; i++)
+			evs[i] = {(EventType)records[i].id, records[i].timestamp, __entry.line, 0, 0};
+	}
+
+	if (__entry.filter) {
+		auto &fs = *__entry.filter;
+		Event out[event_batch_size * 2];
+		size_t n = fs.filter.filter(evs, count, out);
+
+		arm_filter_timer(fs);
+		deliver_filtered(fs, out, n);
+
+		return count;
+	}
+
+	if (__entry.sink)
+		__entry.sink->consume(evs, count);
+	else
+		__entry.handler(evs, count);
+
+	return count;
+}
+
+void GPIO::Device::arm_filter_timer(FilterState &__fs) {
+	uint64_t next = __fs.filter.next_deadline();
+
+	// A later deadline is left alone, the early expiry just re-arms. This keeps
+	// every bounce that pushes the deadline out free of syscalls.
+	if (!next || (__fs.armed && __fs.armed <= next))
+		return;
+
+	itimerspec its{};
+	its.it_value.tv_sec = next / 1000000000ULL;
+	its.it_value.tv_nsec = next % 1000000000ULL;
+
+	if (timerfd_settime(__fs.timerfd, TFD_TIMER_ABSTIME, &its, nullptr))
+		throw ExceptionWithErrno("failed to arm timerfd");
+
+	__fs.armed = next;
+}
+
+void GPIO::Device::filter_timer_expired(FilterState &__fs) {
+	Event out[64];
+
+	__fs.armed = 0;
+	size_t n = __fs.filter.expire(Utils::monotonic_ns(), out);
+
+	arm_filter_timer(__fs);
+	deliver_filtered(__fs, out, n);
+}
+
+void GPIO::Device::deliver_filtered(FilterState &__fs, Event *__evs, size_t __count) {
+	if (__fs.mode != EventMode::Both) {
+		auto wanted = __fs.mode == EventMode::RisingEdge ? EventType::RisingEdge : EventType::FallingEdge;
+		__count = std::remove_if(__evs, __evs + __count, [wanted](const Event& ev) {
+			return ev.type != wanted;
+		}) - __evs;
+	}
+
+	if (!__count)
+		return;
+
+	if (__fs.sink)
+		__fs.sink->consume(__evs, __count);
+	else
+		__fs.handler(__evs, __count);
+}
+
+std::vector<int> GPIO::Device::event_fds() {
+	std::unique_lock<std::mutex> lk(event_lock);
+
+	std::vector<int> ret;
+	for (auto &it : event_sources) {
+		ret.emplace_back(it.first);
+	}
+	return ret;
+}
+
+bool GPIO::Device::is_event_fd(int __fd) {
+	EventTable<EventEntry>::ReadGuard rg(events_table);
+
+	return events_table.load(__fd) != nullptr;
+}
+
+#ifdef GPIOPP_HAVE_IO_URING
+/*
+ * Per-thread io_uring state. Every event fd gets a slot with a read buffer
+ * and is kept armed with a POLL_ADD linked to a READ(_FIXED), since the
+ * event fds are O_NONBLOCK. Only the worker thread touches the ring; other
+ * threads queue attach/detach requests and poke notify_fd.
+ */
+struct GPIO::Device::UringState {
+	static constexpr uint64_t tag_wake = UINT64_MAX;
+	static constexpr uint64_t tag_notify = UINT64_MAX - 1;
+	static constexpr uint64_t tag_ignore = UINT64_MAX - 2;
+
+	enum : uint64_t {
+		KindPoll = 0,
+		KindRead = 1
+	};
+
+	struct Slot {
+		int fd = -1;
+		uint8_t *buf = nullptr;
+		bool fixed = false;
+		bool armed = false;
+		bool closing = false;
+		std::unique_ptr<uint8_t[]> own;
+	};
+
+	IoUring ring;
+	int notify_fd = -1;
+	uint64_t notify_buf = 0;
+	unsigned specials_armed = 0;
+
+	std::unique_ptr<uint8_t[]> fixed_region;
+	size_t fixed_count;
+
+	// deque: slots never move, the kernel may be writing into their buffers
+	std::deque<Slot> slots;
+	std::vector<size_t> free_slots;
+	std::unordered_map<int, size_t> slot_of_fd;
+	size_t armed = 0;
+
+	std::mutex pending_lock;
+	std::vector<std::pair<int, bool>> pending;
+
+	explicit UringState(size_t __fixed_slots) : ring(256), fixed_count(__fixed_slots) {
+		if ((notify_fd = eventfd(0, EFD_CLOEXEC)) == -1)
+			throw ExceptionWithErrno("failed to create eventfd");
+
+		if (fixed_count) {
+			fixed_region.reset(new uint8_t[fixed_count * event_read_size]);
+
+			iovec iov;
+			iov.iov_base = fixed_region.get();
+			iov.iov_len = fixed_count * event_read_size;
+
+			try {
+				ring.register_buffers(&iov, 1);
+			} catch (...) {
+				// Plain reads still work, e.g. under RLIMIT_MEMLOCK
+				fixed_region.reset();
+				fixed_count = 0;
+			}
+		}
+	}
+
+	~UringState() {
+		close(notify_fd);
+	}
+
+	void queue(int __fd, bool __attach) {
+		std::unique_lock<std::mutex> lk(pending_lock);
+		pending.emplace_back(__fd, __attach);
+
+		uint64_t one = 1;
+		if (write(notify_fd, &one, sizeof(one)) == -1)
+			throw ExceptionWithErrno("failed to notify event listener");
+	}
+
+	bool skip_poll_cqes() const noexcept {
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+		return ring.features() & IORING_FEAT_CQE_SKIP;
+#else
+		return false;
+#endif
+	}
+
+	void arm(size_t __idx) {
+		auto &slot = slots[__idx];
+
+		ring.reserve(2);
+
+		auto *sqe = ring.get_sqe();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = slot.fd;
+		sqe->poll_events = POLLIN;
+		sqe->flags = IOSQE_IO_LINK;
+#ifdef IOSQE_CQE_SKIP_SUCCESS
+		if (skip_poll_cqes())
+			sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+#endif
+		sqe->user_data = __idx << 1 | KindPoll;
+
+		sqe = ring.get_sqe();
+		sqe->opcode = slot.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->fd = slot.fd;
+		sqe->addr = (uintptr_t)slot.buf;
+		sqe->len = event_read_size;
+		sqe->buf_index = 0;
+		sqe->user_data = __idx << 1 | KindRead;
+
+		slot.armed = true;
+	}
+
+	void cancel(uint64_t __user_data) {
+		auto *sqe = ring.get_sqe();
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = __user_data;
+		sqe->user_data = tag_ignore;
+	}
+
+	void attach(int __fd) {
+		size_t idx;
+
+		if (!free_slots.empty()) {
+			idx = free_slots.back();
+			free_slots.pop_back();
+		} else {
+			idx = slots.size();
+			slots.emplace_back();
+
+			auto &slot = slots.back();
+			if (idx < fixed_count) {
+				slot.buf = fixed_region.get() + idx * event_read_size;
+				slot.fixed = true;
+			} else {
+				slot.own.reset(new uint8_t[event_read_size]);
+				slot.buf = slot.own.get();
+			}
+		}
+
+		auto &slot = slots[idx];
+		slot.fd = __fd;
+		slot.closing = false;
+		slot_of_fd[__fd] = idx;
+		armed++;
+
+		arm(idx);
+	}
+
+	void detach(int __fd) {
+		auto it = slot_of_fd.find(__fd);
+		if (it == slot_of_fd.end())
+			return;
+
+		// The fd number may be reused right away, the slot lives on until its read completes
+		slots[it->second].closing = true;
+		cancel(it->second << 1 | KindPoll);
+		slot_of_fd.erase(it);
+	}
+
+	void release(size_t __idx) {
+		auto &slot = slots[__idx];
+		slot.armed = false;
+		slot.fd = -1;
+		free_slots.push_back(__idx);
+		armed--;
+	}
+
+	// The poll/read pair of a slot is over: free the slot or start the next pair
+	void finish(size_t __idx, int __res) {
+		if (slots[__idx].closing || (__res < 0 && __res != -EAGAIN && __res != -EINTR))
+			release(__idx);
+		else
+			arm(__idx);
+	}
+
+	// When a POLL_ADD flagged CQE_SKIP_SUCCESS fails, the kernel drops the CQE
+	// of the linked read as well, so the pair ends with the poll's CQE
+	void poll_failed(const io_uring_cqe& __cqe) {
+		if (__cqe.res < 0 && skip_poll_cqes())
+			finish(__cqe.user_data >> 1, __cqe.res);
+	}
+
+	void arm_notify() {
+		auto *sqe = ring.get_sqe();
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = notify_fd;
+		sqe->addr = (uintptr_t)&notify_buf;
+		sqe->len = sizeof(notify_buf);
+		sqe->user_data = tag_notify;
+	}
+
+	void arm_wake(int __wakefd) {
+		auto *sqe = ring.get_sqe();
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = __wakefd;
+		sqe->poll_events = POLLIN;
+		sqe->user_data = tag_wake;
+	}
+
+	void process_pending() {
+		std::vector<std::pair<int, bool>> todo;
+		{
+			std::unique_lock<std::mutex> lk(pending_lock);
+			todo.swap(pending);
+		}
+
+		for (auto &it : todo) {
+			if (it.second)
+				attach(it.first);
+			else
+				detach(it.first);
+		}
+	}
+
+	// Cancels everything in flight and waits, so no buffer is written after we're gone
+	void shutdown() {
+		for (size_t i=0; i<slots.size(); i++) {
+			if (slots[i].armed) {
+				slots[i].closing = true;
+				cancel(i << 1 | KindPoll);
+			}
+		}
+
+		cancel(tag_notify);
+		cancel(tag_wake);
+
+		while (armed || specials_armed) {
+			ring.submit(1);
+			ring.reap([this](const io_uring_cqe& cqe) {
+				if (cqe.user_data == tag_notify || cqe.user_data == tag_wake)
+					specials_armed--;
+				else if (cqe.user_data != tag_ignore && (cqe.user_data & 1) == KindRead)
+					release(cqe.user_data >> 1);
+				else if (cqe.user_data != tag_ignore)
+					poll_failed(cqe);
+			});
+		}
+	}
+};
+#endif
+
+void GPIO::Device::listener_attach(int __fd, EventSource& __src) {
+	size_t n = listener_workers.size();
+
+	// Sinks and filters of a group assume a single delivering thread, so the
+	// shard is picked once, by whichever of its fds comes first
+	auto it = listener_group_shards.find(__src.group);
+
+	if (it != listener_group_shards.end())
+		__src.shard = it->second;
+	else {
+		if (__src.shard_hint >= 0)
+			__src.shard = __src.shard_hint % n;
+		else if (listener_options.sharding == ListenerSharding::ByLine)
+			__src.shard = __src.line % n;
+		else
+			__src.shard = listener_rr++ % n;
+
+		listener_group_shards.emplace(__src.group, __src.shard);
+	}
+
+	auto &w = listener_workers[__src.shard];
+
+#ifdef GPIOPP_HAVE_IO_URING
+	if (w.uring) {
+		w.uring->queue(__fd, true);
+		return;
+	}
+#endif
+
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = __fd;
+
+	epoll_ctl(w.epfd, EPOLL_CTL_ADD, __fd, &ev);
+}
+
+void GPIO::Device::listener_detach(int __fd, const EventSource& __src) {
+	auto &w = listener_workers[__src.shard];
+
+#ifdef GPIOPP_HAVE_IO_URING
+	if (w.uring) {
+		w.uring->queue(__fd, false);
+		return;
+	}
+#endif
+
+	epoll_ctl(w.epfd, EPOLL_CTL_DEL, __fd, nullptr);
+}
+
+void GPIO::Device::listener_loop(size_t __idx) try {
+	if (listener_options.pin_cpus) {
+		auto &cpus = listener_options.cpus;
+		Utils::set_thread_affinity(cpus.empty() ? __idx : cpus[__idx % cpus.size()]);
+	}
+
+	if (listener_workers[__idx].uring) {
+		listener_loop_uring(__idx);
+		return;
+	}
+
+	int epfd = listener_workers[__idx].epfd;
+	int ep_rc;
+	epoll_event evs[16];
+
+	// No timeout: stop_eventlistener() wakes us through listener_wakefd
+	while ((ep_rc = epoll_wait(epfd, evs, 16, -1)) != -1 || errno == EINTR) {
+		for (int i=0; i<ep_rc; i++) {
+			if (evs[i].data.fd != listener_wakefd)
+				dispatch_event(evs[i].data.fd, false);
+		}
+
+		if (!eventlistener_run)
+			break;
+	}
+} catch (...) {
+	// A throwing handler stops every shard, run_eventlistener() rethrows it
+	listener_workers[__idx].error = std::current_exception();
+	stop_eventlistener();
+}
+
+void GPIO::Device::listener_loop_uring(size_t __idx) {
+#ifdef GPIOPP_HAVE_IO_URING
+	auto &u = *listener_workers[__idx].uring;
+
+	u.arm_wake(listener_wakefd);
+	u.arm_notify();
+	u.specials_armed = 2;
+	u.process_pending();
+
+	try {
+		while (eventlistener_run) {
+			u.ring.submit(1);
+
+			bool notified = false;
+			std::exception_ptr error;
+
+			u.ring.reap([&](const io_uring_cqe& cqe) {
+				if (cqe.user_data == UringState::tag_ignore) {
+					return;
+				} else if (cqe.user_data == UringState::tag_wake) {
+					// Level-triggered by design, don't re-arm
+					u.specials_armed--;
+					return;
+				} else if (cqe.user_data == UringState::tag_notify) {
+					notified = true;
+					return;
+				}
+
+				size_t idx = cqe.user_data >> 1;
+				auto &slot = u.slots[idx];
+
+				if ((cqe.user_data & 1) == UringState::KindPoll) {
+					u.poll_failed(cqe);
+					return;
+				}
+
+				// A throwing handler must not leave the slot or the rest of the batch
+				// unaccounted for: shutdown() waits for every request in flight, and
+				// the other reads already took their events from the kernel
+				if (cqe.res > 0 && !slot.closing) {
+					try {
+						EventTable<EventEntry>::ReadGuard rg(events_table);
+
+						auto *e = events_table.load(slot.fd);
+						if (e)
+							deliver_events(*e, slot.buf, cqe.res);
+					} catch (...) {
+						if (!error)
+							error = std::current_exception();
+					}
+				}
+
+				u.finish(idx, cqe.res);
+			});
+
+			if (notified) {
+				u.arm_notify();
+				u.process_pending();
+			}
+
+			if (error)
+				std::rethrow_exception(error);
+		}
+	} catch (...) {
+		u.shutdown();
+		throw;
+	}
+
+	u.shutdown();
+#endif
+}
+
+void GPIO::Device::listener_cleanup() {
+	for (auto &it : listener_workers) {
+		if (it.epfd != -1)
+			close(it.epfd);
+#ifdef GPIOPP_HAVE_IO_URING
+		delete it.uring;
+#endif
+	}
+	listener_workers.clear();
+	listener_group_shards.clear();
+
+	if (listener_wakefd != -1)
+		close(listener_wakefd);
+	listener_wakefd = -1;
+}
+
+void GPIO::Device::run_eventlistener(const ListenerOptions& __options) {
+	std::unique_lock<std::mutex> lk(event_lock);
+
+	if (!listener_workers.empty())
+		throw std::logic_error("event listener already running");
+
+	bool use_uring = false;
+
+#ifdef GPIOPP_HAVE_IO_URING
+	if (__options.backend == ListenerBackend::IoUring)
+		use_uring = true;
+	else if (__options.backend == ListenerBackend::Auto)
+		use_uring = IoUring::available();
+#else
+	if (__options.backend == ListenerBackend::IoUring)
+		throw std::logic_error("GPIO++ was built without io_uring support");
+#endif
+
+	if ((listener_wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+		throw ExceptionWithErrno("failed to create eventfd");
+
+	listener_options = __options;
+	listener_workers.resize(std::max<size_t>(1, __options.threads));
+
+	try {
+		for (auto &it : listener_workers) {
+#ifdef GPIOPP_HAVE_IO_URING
+			if (use_uring) {
+				it.uring = new UringState(__options.uring_fixed_slots);
+				continue;
+			}
+#endif
+			epoll_event ev;
+			ev.events = EPOLLIN;
+			ev.data.fd = listener_wakefd;
+
+			if ((it.epfd = epoll_create1(EPOLL_CLOEXEC)) == -1 || epoll_ctl(it.epfd, EPOLL_CTL_ADD, listener_wakefd, &ev))
+				throw ExceptionWithErrno("failed to create epoll instance");
+		}
+
+		for (auto &it : event_sources)
+			listener_attach(it.first, it.second);
+	} catch (...) {
+		listener_cleanup();
+		throw;
+	}
+
+	if (debug)
+		std::cerr << "GPIO++: " << "Event listener started, threads=" << listener_workers.size()
+			  << ", backend=" << (use_uring ? "io_uring" : "epoll") << "\n";
+
+	eventlistener_run = true;
+
+	for (size_t i=1; i<listener_workers.size(); i++) {
+		listener_workers[i].thread = std::thread([this, i](){
+			listener_loop(i);
+		});
+	}
+
+	lk.unlock();
+
+	listener_loop(0);
+
+	for (size_t i=1; i<listener_workers.size(); i++)
+		listener_workers[i].thread.join();
+
+	lk.lock();
+
+	std::exception_ptr error;
+	for (auto &it : listener_workers) {
+		if (!error)
+			error = it.error;
+	}
+
+	listener_cleanup();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void GPIO::Device::stop_eventlistener() {
+	std::unique_lock<std::mutex> lk(event_lock);
+
+	eventlistener_run = false;
+
+	// Never read back, so the eventfd stays readable and wakes every worker
+	if (listener_wakefd != -1) {
+		uint64_t one = 1;
+		if (write(listener_wakefd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+			throw ExceptionWithErrno("failed to wake event listener");
+	}
+}
+
+GPIO::LineSingle GPIO::LineSingle::duplicate() const {
+	int nfd = GPIO::Sys::dup(fd);
+	if (nfd == -1)
+		throw ExceptionWithErrno("failed to duplicate line handle");
+
+	LineSingle ret(nfd, pfd, offset_, name_, label_, v2_);
+	ret.info_ = info_;
+	ret.claim_ = claim_;
+	ret.debug = debug;
+	return ret;
+}
+
+uint8_t GPIO::LineSingle::read() {
+	uint8_t value;
+
+#ifdef GPIOPP_ABI_V2
+	if (v2_) {
+		gpio_v2_line_values data{};
+		data.mask = 1;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to read value from line");
+
+		value = data.bits & 1;
+	} else
+#endif
+	{
+		gpiohandle_data data{};
+
+		if (GPIO::Sys::ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to read value from line");
+
+		value = data.values[0];
+	}
+
+	if (debug)
+		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value read: " << +value << "\n";
+
+	return value;
+}
+
+void GPIO::LineSingle::write(uint8_t __value) {
+#ifdef GPIOPP_ABI_V2
+	if (v2_) {
+		gpio_v2_line_values data{};
+		data.bits = __value ? 1 : 0;
+		data.mask = 1;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to write value to line");
+	} else
+#endif
+	{
+		gpiohandle_data data{};
+		data.values[0] = __value;
+
+		if (GPIO::Sys::ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to write value to line");
+	}
+
+	if (debug)
+		std::cerr << "GPIO++: " << "Line " << number() << " '" << label() << "': value write: " << +__value << "\n";
+}
+
+GPIO::LineMode GPIO::LineSingle::mode() const {
+	LineInfo linfo;
+
+	if (info_ && info_->watched() && info_->load(offset_, linfo))
+		return linfo.mode;
+
+	return query_line_info(pfd, v2_, offset_).mode;
+}
+
+void GPIO::LineSingle::set_mode(GPIO::LineMode __mode, uint8_t __default_value, const std::string &__label) {
+	apply_default_bias(__mode);
+
+	if (info_)
+		info_->expect_change(offset_);
+
+	// The consumer label can only be set by a new request
+	if ((__label.empty() || __label == label_) && set_line_config(fd, v2_, 1, __mode, __default_value ? 1 : 0)) {
+		if (debug)
+			std::cerr << "GPIO++: " << "Line " << number() << ": mode changed in place, mode="
+				  << (uint)__mode << ", default_value=" << +__default_value << "\n";
+		return;
+	}
+
+	GPIO::Sys::close(fd);
+	fd = -1;
+
+	LineSpec ls{offset_, __default_value};
+
+#ifdef GPIOPP_ABI_V2
+	if (v2_)
+		fd = request_lines_v2(pfd, &ls, 1, __mode, __label);
+	else
+#endif
+		fd = request_lines_v1(pfd, &ls, 1, __mode, __label);
+
+	label_ = __label;
+
+	if (debug)
+		std::cerr << "GPIO++: " << "Line " << number() << ": mode changed, mode="
+			  << (uint)__mode << ", default_value=" << +__default_value << ", label=" << __label << "\n";
+}
+
+GPIO::LineMultiple GPIO::LineMultiple::duplicate() const {
+	int nfd = GPIO::Sys::dup(fd);
+	if (nfd == -1)
+		throw ExceptionWithErrno("failed to duplicate line handle");
+
+	LineMultiple ret(nfd, size, v2_);
+	ret.shadow_ = shadow_;
+	ret.claim_ = claim_;
+	ret.pfd_ = pfd_;
+	ret.offsets_ = offsets_;
+	ret.label_ = label_;
+	ret.info_ = info_;
+	return ret;
+}
+
+std::vector<uint8_t> GPIO::LineMultiple::read() {
+	std::vector<uint8_t> ret(size);
+	read(ret.data());
+	return ret;
+}
+
+void GPIO::LineMultiple::write(const std::vector<uint8_t> &__values) {
+	write(__values.data(), __values.size());
+}
+
+void GPIO::LineMultiple::read(uint8_t *__values) {
+#ifdef GPIOPP_ABI_V2
+	if (v2_) {
+		uint64_t bits = read_bits();
+		for (uint8_t i=0; i<size; i++)
+			__values[i] = (bits >> i) & 1;
+		return;
+	}
+#endif
+
+	gpiohandle_data data{};
+
+	if (GPIO::Sys::ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to read values from lines");
+
+	memcpy(__values, data.values, size);
+}
+
+void GPIO::LineMultiple::write(const uint8_t *__values, size_t __count) {
+	// The kernel always reads a full gpiohandle_data, a short buffer must never reach it
+	if (__count != size)
+		throw std::logic_error("value count doesn't match line count");
+
+	uint64_t bits = 0;
+	for (uint8_t i=0; i<size; i++) {
+		if (__values[i])
+			bits |= 1ULL << i;
+	}
+	write_bits(bits);
+}
+
+uint64_t GPIO::LineMultiple::read_bits() {
+#ifdef GPIOPP_ABI_V2
+	if (v2_) {
+		gpio_v2_line_values data{};
+		data.mask = line_mask(size);
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to read values from lines");
+
+		return data.bits & data.mask;
+	}
+#endif
+
+	gpiohandle_data data{};
+
+	if (GPIO::Sys::ioctl(fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to read values from lines");
+
+	uint64_t bits = 0;
+	for (uint8_t i=0; i<size; i++) {
+		if (data.values[i])
+			bits |= 1ULL << i;
+	}
+	return bits;
+}
+
+void GPIO::LineMultiple::write_bits(uint64_t __bits) {
+#ifdef GPIOPP_ABI_V2
+	if (v2_) {
+		gpio_v2_line_values data{};
+		data.mask = line_mask(size);
+		data.bits = __bits & data.mask;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to write values to lines");
+
+		return;
+	}
+#endif
+
+	if (!shadow_)
+		throw std::logic_error("line handle was moved from");
+
+	std::lock_guard<std::mutex> lg(shadow_->lock);
+	write_bits_v1(__bits);
+	shadow_->bits = __bits & line_mask(size);
+	shadow_->valid = true;
+}
+
+void GPIO::LineMultiple::write_bits_v1(uint64_t __bits) {
+	gpiohandle_data data{};
+	for (uint8_t i=0; i<size; i++)
+		data.values[i] = (__bits >> i) & 1;
+
+	if (GPIO::Sys::ioctl(fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data))
+		throw ExceptionWithErrno("failed to write values to lines");
+}
+
+uint64_t GPIO::LineMultiple::read_masked(uint64_t __mask) {
+	__mask &= line_mask(size);
+
+#ifdef GPIOPP_ABI_V2
+	if (v2_) {
+		gpio_v2_line_values data{};
+		data.mask = __mask;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to read values from lines");
+
+		return data.bits & __mask;
+	}
+#endif
+
+	return read_bits() & __mask;
+}
+
+void GPIO::LineMultiple::write_masked(uint64_t __bits, uint64_t __mask) {
+	__mask &= line_mask(size);
+
+	if (!__mask)
+		return;
+
+#ifdef GPIOPP_ABI_V2
+	if (v2_) {
+		// The kernel leaves lines outside the mask alone
+		gpio_v2_line_values data{};
+		data.mask = __mask;
+		data.bits = __bits & __mask;
+
+		if (GPIO::Sys::ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &data))
+			throw ExceptionWithErrno("failed to write values to lines");
+
+		return;
+	}
+#endif
+
+	// v1 always sets every line, so merge into the last written state.
+	// The shadow is shared by all duplicates of this handle.
+	if (!shadow_)
+		throw std::logic_error("line handle was moved from");
+
+	std::lock_guard<std::mutex> lg(shadow_->lock);
+
+	if (!shadow_->valid) {
+		shadow_->bits = read_bits();
+		shadow_->valid = true;
+	}
+
+	uint64_t nv = (shadow_->bits & ~__mask) | (__bits & __mask);
+	write_bits_v1(nv);
+	shadow_->bits = nv;
+}
+
+void GPIO::LineMultiple::set_mode(GPIO::LineMode __mode, uint64_t __default_bits, const std::string &__label) {
+	apply_default_bias(__mode);
+	__default_bits &= line_mask(size);
+
+	if (info_) {
+		for (auto it : offsets_)
+			info_->expect_change(it);
+	}
+
+	// The consumer label can only be set by a new request
+	if (!((__label.empty() || __label == label_) && set_line_config(fd, v2_, size, __mode, __default_bits))) {
+		if (pfd_ == -1)
+			throw std::logic_error("can't request these lines again, the handle wasn't made by a Device");
+
+		LineSpec lss[64];
+		for (uint8_t i=0; i<size; i++)
+			lss[i] = {offsets_[i], (uint8_t)((__default_bits >> i) & 1)};
+
+		GPIO::Sys::close(fd);
+		fd = -1;
+
+#ifdef GPIOPP_ABI_V2
+		if (v2_)
+			fd = request_lines_v2(pfd_, lss, size, __mode, __label);
+		else
+#endif
+			fd = request_lines_v1(pfd_, lss, size, __mode, __label);
+
+		label_ = __label;
+	}
+
+	// Outputs now hold the default values, inputs invalidate the v1 shadow
+	if (shadow_) {
+		std::lock_guard<std::mutex> lg(shadow_->lock);
+		shadow_->bits = __default_bits;
+		shadow_->valid = (__mode & LineMode::Output) == LineMode::Output;
+	}
+}
+
+void GPIO::LineGroup::add(LineMultiple &&__handle) {
+	starts_.push_back(num_lines_);
+	num_lines_ += __handle.num_lines();
+	handles_.push_back(std::move(__handle));
+}
+
+void GPIO::LineGroup::add(const LineMultiple &__handle) {
+	add(__handle.duplicate());
+}
+
+GPIO::LineGroup GPIO::LineGroup::duplicate() const {
+	LineGroup ret;
+
+	for (auto &it : handles_)
+		ret.add(it);
+
+	return ret;
+}
+
+void GPIO::LineGroup::add(const LineGroup &__group) {
+	for (auto &it : __group.handles_)
+		add(it);
+}
+
+void GPIO::LineGroup::read(uint8_t *__values) {
+	for (size_t i=0; i<handles_.size(); i++)
+		handles_[i].read(__values + starts_[i]);
+}
+
+void GPIO::LineGroup::write(const uint8_t *__values, size_t __count) {
+	if (__count != num_lines_)
+		throw std::logic_error("value count doesn't match line count");
+
+	for (size_t i=0; i<handles_.size(); i++)
+		handles_[i].write(__values + starts_[i], handles_[i].num_lines());
+}
+
+uint64_t GPIO::LineGroup::extract(const uint64_t *__words, size_t __idx) const noexcept {
+	size_t start = starts_[__idx], w = start / 64, sh = start % 64;
+	size_t n = handles_[__idx].num_lines();
+
+	uint64_t v = __words[w] >> sh;
+	if (sh && sh + n > 64)
+		v |= __words[w+1] << (64 - sh);
+
+	return v & line_mask(n);
+}
+
+void GPIO::LineGroup::read_bits(uint64_t *__words) {
+	std::fill(__words, __words + num_words(), 0);
+
+	for (size_t i=0; i<handles_.size(); i++) {
+		size_t start = starts_[i], w = start / 64, sh = start % 64;
+		uint64_t v = handles_[i].read_bits();
+
+		__words[w] |= v << sh;
+		if (sh && sh + handles_[i].num_lines() > 64)
+			__words[w+1] |= v >> (64 - sh);
+	}
+}
+
+void GPIO::LineGroup::write_bits(const uint64_t *__words) {
+	for (size_t i=0; i<handles_.size(); i++)
+		handles_[i].write_bits(extract(__words, i));
+}
+
+void GPIO::LineGroup::write_masked(const uint64_t *__bits, const uint64_t *__mask) {
+	for (size_t i=0; i<handles_.size(); i++) {
+		uint64_t m = extract(__mask, i);
+
+		// Handles with nothing to change cost no ioctl
+		if (m)
+			handles_[i].write_masked(extract(__bits, i), m);
+	}
 }
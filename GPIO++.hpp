@@ -24,9 +24,15 @@
 #include <initializer_list>
 #include <unordered_map>
 #include <map>
+#include <memory>
+#include <bitset>
 #include <functional>
-#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
 #include <stdexcept>
+#include <exception>
 #include <system_error>
 
 #include <cstring>
@@ -38,9 +44,12 @@
 #include <linux/types.h>
 #include <linux/version.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 
 #include "Utils.hpp"
+#include "EventTable.hpp"
+#include "ChipBackend.hpp"
 
 #ifndef GPIOHANDLE_REQUEST_BIAS_DISABLE
 #define GPIOHANDLE_REQUEST_BIAS_DISABLE 0
@@ -54,9 +63,20 @@
 #define GPIOHANDLE_REQUEST_BIAS_PULL_DOWN 0
 #endif
 
+// Character device ABI v2 (Linux 5.10+). Still selected at runtime, see Device::abi_version()
+#ifdef GPIO_V2_GET_LINE_IOCTL
+#define GPIOPP_ABI_V2
+#endif
+
+// Line info change notifications (Linux 5.7+), see Device::watch_line_info()
+#ifdef GPIO_GET_LINEINFO_WATCH_IOCTL
+#define GPIOPP_HAVE_LINEINFO_WATCH
+#endif
+
 namespace YukiWorkshop::GPIO {
 	class Device;
 	class Line;
+	class LineInfoCache;
 
 	enum class LineMode : int {
 		Input = GPIOHANDLE_REQUEST_INPUT,
@@ -174,30 +194,152 @@ namespace YukiWorkshop::GPIO {
 		return x;
 	}
 
+	enum class EventClock : int {
+		Monotonic,
+		Realtime,
+		HTE
+	};
+
+	struct EventOptions {
+		// Kernel-side debounce period, ABI v2 only
+		uint32_t debounce_us = 0;
+		// Timestamp source, anything but Monotonic needs ABI v2
+		EventClock clock = EventClock::Monotonic;
+		// Suggested kernel event queue length, 0 for the kernel default
+		uint32_t buffer_size = 0;
+		// Listener thread to deliver these events on, -1 to follow ListenerOptions::sharding.
+		// All fds of one handle are always delivered by the same thread.
+		int shard = -1;
+		// Userspace debounce: report a level only after it held this long (see EdgeFilter).
+		// With either filter on, both edges are requested and the other one dropped afterwards.
+		uint64_t min_stable_ns = 0;
+		// Userspace glitch filter: drop pulses shorter than this, both edges
+		uint64_t min_pulse_ns = 0;
+	};
+
+	enum class ListenerSharding : int {
+		ByLine,
+		RoundRobin
+	};
+
+	enum class ListenerBackend : int {
+		// io_uring when built in and allowed by the kernel, epoll otherwise
+		Auto,
+		Epoll,
+		IoUring
+	};
+
+	struct ListenerOptions {
+		// Each thread has its own epoll instance (or io_uring), every event fd is served by exactly one of them
+		size_t threads = 1;
+		ListenerBackend backend = ListenerBackend::Auto;
+		// io_uring: fds per thread reading into registered buffers, any beyond use plain buffers
+		size_t uring_fixed_slots = 64;
+		ListenerSharding sharding = ListenerSharding::ByLine;
+		// Pin listener thread i to cpus[i % cpus.size()], or to CPU i when cpus is empty
+		bool pin_cpus = false;
+		std::vector<int> cpus;
+	};
+
+	struct Event {
+		EventType type;
+		uint64_t timestamp;
+		uint32_t line;
+		// Sequence numbers from the kernel, always 0 on ABI v1
+		uint32_t seqno;
+		uint32_t line_seqno;
+	};
+
+	typedef std::function<void(EventType, uint64_t)> EventHandler;
+	typedef std::function<void(uint32_t, EventType, uint64_t)> LineEventHandler;
+	typedef std::function<void(const Event *, size_t)> BatchEventHandler;
+	typedef std::function<void(const uint8_t *, size_t)> FdHandler;
+
+	// Allocation-free alternative to handlers, consume() is called on the listener thread
+	class EventSink {
+	public:
+		virtual ~EventSink() = default;
+
+		virtual void consume(const Event *__events, size_t __count) = 0;
+	};
+
 	struct LineSpec {
 		uint32_t line_number;
 		uint8_t default_value;
 	};
 
+	struct LineInfo {
+		uint32_t offset = 0;
+		LineMode mode{};
+		// Requested by any process, this one included, or claimed by a kernel driver
+		bool used = false;
+		char name[32] = {};
+		char consumer[32] = {};
+	};
+
+	enum class LineInfoChange : int {
+		Requested = 1,
+		Released = 2,
+		Reconfigured = 3
+	};
+
+	typedef std::function<void(const LineInfo&, LineInfoChange, uint64_t)> LineInfoHandler;
+
 	class Line {
+		friend class Device;
 	protected:
 		int fd = -1;
 		uint8_t size = 0;
+		bool v2_ = false;
+		// Marks the lines as held by this process in the device's line info cache, shared by duplicates
+		std::shared_ptr<void> claim_;
 	public:
 		Line() = default;
 
-		Line(int __fd, size_t __size) : fd(__fd), size(__size) {}
+		Line(int __fd, size_t __size, bool __v2 = false) : fd(__fd), size(__size), v2_(__v2) {}
+
+		// Line handles own their fd. Move them, or put them in a shared_ptr
+		// (SharedLineSingle, SharedLineMultiple) to share one handle cheaply.
+		Line(const Line&) = delete;
+		Line& operator=(const Line&) = delete;
+
+		Line(Line&& other) noexcept : fd(other.fd), size(other.size), v2_(other.v2_), claim_(std::move(other.claim_)) {
+			other.fd = -1;
+		}
+
+		// The claim goes first, so the line info cache expects the release before it happens
+		Line& operator=(Line&& other) noexcept {
+			if (this != &other) {
+				claim_.reset();
+				if (fd != -1)
+					Sys::close(fd);
+
+				fd = other.fd;
+				size = other.size;
+				v2_ = other.v2_;
+				claim_ = std::move(other.claim_);
+				other.fd = -1;
+			}
+
+			return *this;
+		}
 
 		virtual ~Line() {
-			close(fd);
+			claim_.reset();
+			if (fd != -1)
+				Sys::close(fd);
 		}
 	};
 
 	class LineSingle : public Line {
+		friend class Device;
 	private:
 		int pfd = -1;
 		uint32_t offset_ = 0;
 		std::string name_, label_;
+		// Lets mode() skip the ioctl while the device watches line info, and
+		// is told about our own changes so it doesn't serve them stale
+		std::shared_ptr<LineInfoCache> info_;
 	public:
 		LineSingle() = default;
 
@@ -208,23 +350,16 @@ namespace YukiWorkshop::GPIO {
 			label_ = __info.consumer;
 		}
 
-		LineSingle(const LineSingle& other) {
-			fd = dup(other.fd);
-			size = other.size;
-			pfd = other.pfd;
-			name_ = other.name_;
-			label_ = other.label_;
+		LineSingle(int __fd, int __pfd, uint32_t __offset, std::string __name, std::string __label, bool __v2) :
+			Line(__fd, 1, __v2), offset_(__offset), name_(std::move(__name)), label_(std::move(__label)) {
+			pfd = __pfd;
 		}
 
-		LineSingle& operator=(const LineSingle& other) {
-			fd = dup(other.fd);
-			size = other.size;
-			pfd = other.pfd;
-			name_ = other.name_;
-			label_ = other.label_;
+		LineSingle(LineSingle&&) noexcept = default;
+		LineSingle& operator=(LineSingle&&) noexcept = default;
 
-			return *this;
-		}
+		// A second, independent handle to the same line, costs a dup()
+		LineSingle duplicate() const;
 
 		bool debug = false;
 
@@ -240,8 +375,12 @@ namespace YukiWorkshop::GPIO {
 			return offset_;
 		}
 
+		// Served from the device's line info cache when it is watched, one ioctl otherwise
 		LineMode mode() const;
 
+		// Reconfigures the line in place, keeping the fd and the request: one ioctl and no
+		// glitch. The line is only released and requested again when the kernel can't do
+		// that (v1 before Linux 5.5) or a different non-empty __label is given.
 		void set_mode(LineMode __mode, uint8_t __default_value = 0, const std::string& __label = "");
 
 		uint8_t read();
@@ -249,44 +388,224 @@ namespace YukiWorkshop::GPIO {
 	};
 
 	class LineMultiple : public Line {
+		friend class Device;
+	private:
+		// Last values written through this handle, v1 can only set all lines at once
+		struct Shadow {
+			std::mutex lock;
+			uint64_t bits = 0;
+			bool valid = false;
+		};
+
+		std::shared_ptr<Shadow> shadow_ = std::make_shared<Shadow>();
+
+		// Only needed to request the lines again, see set_mode()
+		int pfd_ = -1;
+		std::vector<uint32_t> offsets_;
+		std::string label_;
+		// Told about set_mode(), see LineInfoCache::expect_change()
+		std::shared_ptr<LineInfoCache> info_;
+
+		void write_bits_v1(uint64_t __bits);
 	public:
 		LineMultiple() = default;
 
-		LineMultiple(int __fd, size_t __size) : Line(__fd, __size) {}
+		LineMultiple(int __fd, size_t __size, bool __v2 = false) : Line(__fd, __size, __v2) {}
 
-		LineMultiple(const LineMultiple& other) {
-			fd = dup(other.fd);
-			size = other.size;
-		}
+		LineMultiple(LineMultiple&&) noexcept = default;
+		LineMultiple& operator=(LineMultiple&&) noexcept = default;
 
-		LineMultiple& operator=(const LineMultiple& other) {
-			fd = dup(other.fd);
-			size = other.size;
+		// A second handle to the same lines, costs a dup(). Both share the v1 shadow register.
+		LineMultiple duplicate() const;
 
-			return *this;
+		uint8_t num_lines() const noexcept {
+			return size;
 		}
 
 		std::vector<uint8_t> read();
 		void write(const std::vector<uint8_t>& __values);
+
+		// Allocation-free forms, each one is exactly one ioctl.
+		// __values holds one byte per line; __count must equal num_lines().
+		void read(uint8_t *__values);
+		void write(const uint8_t *__values, size_t __count);
+
+		// Bit i is the value of the i-th requested line
+		uint64_t read_bits();
+		void write_bits(uint64_t __bits);
+
+		void write(const std::bitset<64>& __bits) {
+			write_bits(__bits.to_ullong());
+		}
+
+		// Only lines whose bit is set in __mask are read or changed.
+		// Thread-safe; on the v1 ABI this goes through a shadow register.
+		uint64_t read_masked(uint64_t __mask);
+		void write_masked(uint64_t __bits, uint64_t __mask);
+
+		// Like LineSingle::set_mode(), bit i of __default_bits is the output value of line i.
+		// Only a different non-empty __label means a new request. Duplicates see the new
+		// mode too, but while they exist a new request fails with EBUSY.
+		void set_mode(LineMode __mode, uint64_t __default_bits = 0, const std::string& __label = "");
+	};
+
+	/*
+	 * Any number of lines, possibly from several chips, behind one set of
+	 * read/write calls. Each call is one ioctl per kernel handle.
+	 *
+	 * Line i of the group is values[i] in the byte forms, and bit i%64 of
+	 * words[i/64] in the bit forms; those arrays hold num_words() entries.
+	 */
+	class LineGroup {
+	private:
+		std::vector<LineMultiple> handles_;
+		std::vector<size_t> starts_;
+		size_t num_lines_ = 0;
+
+		uint64_t extract(const uint64_t *__words, size_t __idx) const noexcept;
+	public:
+		LineGroup() = default;
+
+		LineGroup(LineGroup&&) noexcept = default;
+		LineGroup& operator=(LineGroup&&) noexcept = default;
+
+		// Duplicates every handle, see LineMultiple::duplicate()
+		LineGroup duplicate() const;
+
+		// Lines of __handle are appended after the current ones
+		void add(LineMultiple&& __handle);
+		// These duplicate the handles
+		void add(const LineMultiple& __handle);
+		void add(const LineGroup& __group);
+
+		size_t num_lines() const noexcept {
+			return num_lines_;
+		}
+
+		size_t num_words() const noexcept {
+			return (num_lines_ + 63) / 64;
+		}
+
+		size_t num_handles() const noexcept {
+			return handles_.size();
+		}
+
+		void read(uint8_t *__values);
+		void write(const uint8_t *__values, size_t __count);
+
+		void read_bits(uint64_t *__words);
+		void write_bits(const uint64_t *__words);
+
+		// Handles without any bit set in __mask are skipped
+		void write_masked(const uint64_t *__bits, const uint64_t *__mask);
 	};
 
 	class Device {
 	private:
 		int fd = -1;
-		int epfd = -1;
-		bool eventlistener_run = false;
+		std::atomic<bool> eventlistener_run{false};
+		uint8_t abi_version_ = 1;
 
 		std::string path_;
 		std::string name_, label_;
 		uint32_t num_lines_ = 0;
-		std::shared_mutex event_lock;
+		// Serializes writers of events_table, readers never take it
+		std::mutex event_lock;
+		// Serializes reclaim_events(), taken before event_lock
+		std::mutex reclaim_lock;
 
 		std::map<uint32_t, std::string> lines_by_num_;
 		std::map<std::string, uint32_t> lines_by_name_;
 
-		std::unordered_map<int, std::function<void(EventType, uint64_t)>> events_map;
+		typedef std::vector<std::pair<int, LineInfoHandler>> LineInfoSubscribers;
+
+		std::shared_ptr<LineInfoCache> line_info_;
+		// Dup of the chip fd the kernel queues line info changes on, -1 until watch_line_info()
+		int line_info_fd_ = -1;
+		// Copy-on-write, the listener loads it once per batch of changes
+		std::shared_ptr<const LineInfoSubscribers> line_info_subs_;
+		int line_info_next_id_ = 0;
+		std::mutex line_info_lock;
+
+		struct FilterState;
+
+		struct EventEntry {
+			BatchEventHandler handler;
+			EventSink *sink = nullptr;
+			uint32_t line = 0;
+			bool v2 = false;
+			// Handle of the add_event() call this fd belongs to
+			int group = -1;
+			// Set for fds added by add_fd_handler(), gets the raw bytes read
+			FdHandler fd_handler;
+			// Set when EventOptions asks for userspace filtering, shared with the filter's timer entry
+			std::shared_ptr<FilterState> filter;
+			// Line info cache claim for the lines of this fd
+			std::shared_ptr<void> claim;
+		};
+
+		struct EventSource {
+			int group;
+			uint32_t line;
+			int shard_hint;
+			size_t shard = 0;
+		};
+
+		struct UringState;
+
+		struct ListenerWorker {
+			int epfd = -1;
+			// Set instead of epfd when the worker runs on io_uring
+			UringState *uring = nullptr;
+			std::thread thread;
+			std::exception_ptr error;
+		};
+
+		EventTable<EventEntry> events_table;
+		// Writer side bookkeeping, keyed by fd
+		std::map<int, EventSource> event_sources;
+
+		ListenerOptions listener_options;
+		std::vector<ListenerWorker> listener_workers;
+		// Registered in every worker's epoll set, written once by stop_eventlistener()
+		int listener_wakefd = -1;
+		// Nested epoll instance for external event loops, see poll_fd()
+		int poll_epfd = -1;
+		size_t listener_rr = 0;
+		// Shard of each event group while the listener runs, every fd of a handle goes there
+		std::map<int, size_t> listener_group_shards;
+
+		// Never with event_lock held: handlers, which it waits for, may take it
+		void reclaim_events();
+
+		void register_event_fd(int __fd, EventEntry *__entry, const EventSource& __src);
+
+		void listener_attach(int __fd, EventSource& __src);
+		void listener_detach(int __fd, const EventSource& __src);
+		void listener_loop(size_t __idx);
+		void listener_loop_uring(size_t __idx);
+		void listener_cleanup();
+
+		size_t dispatch_event(int __fd, bool __must_exist, size_t __max_events = event_batch_size);
+		size_t deliver_events(EventEntry& __entry, const uint8_t *__buf, size_t __len);
+		void filter_timer_expired(FilterState& __fs);
+		void arm_filter_timer(FilterState& __fs);
+		void deliver_filtered(FilterState& __fs, Event *__evs, size_t __count);
+
+		int add_event(const std::vector<uint32_t>& __line_numbers, LineMode __line_mode, EventMode __event_mode,
+			      BatchEventHandler __handler, EventSink *__sink, const std::string& __label, const EventOptions& __options);
+
+		void detect_abi();
+
+		int request_events(const std::vector<uint32_t>& __line_numbers, LineMode __line_mode, EventMode __event_mode,
+				   const EventOptions& __options, const std::string& __label);
 
 		void get_device_info();
+		void load_line_names();
+
+		std::shared_ptr<void> claim_lines(const uint32_t *__lines, size_t __count);
+		void expect_line_changes(const uint32_t *__lines, size_t __count);
+		void line_info_changed(const uint8_t *__buf, size_t __len);
 
 	public:
 		Device() = default;
@@ -301,21 +620,15 @@ namespace YukiWorkshop::GPIO {
 			open(__path);
 		}
 
-		~Device() {
-			if (fd > 0)
-				close(fd);
-			if (epfd > 0)
-				close(epfd);
-		}
+		~Device();
 
-		Device& operator=(const Device& other) {
-			open(other.path_);
-			return *this;
-		}
+		// Devices own their chip fd. Moving one costs no syscalls, but only
+		// before any event is added. Share a Device with SharedDevice.
+		Device(const Device&) = delete;
+		Device& operator=(const Device&) = delete;
 
-		Device(const Device& other) {
-			open(other.path_);
-		}
+		Device(Device&& other);
+		Device& operator=(Device&& other);
 
 		const std::string& name() const noexcept {
 			return name_;
@@ -333,6 +646,11 @@ namespace YukiWorkshop::GPIO {
 			return num_lines_;
 		}
 
+		// 2 if the kernel speaks the v2 character device ABI, 1 otherwise
+		uint8_t abi_version() const noexcept {
+			return abi_version_;
+		}
+
 		std::map<uint32_t, std::string>& lines_by_num();
 		std::map<std::string, uint32_t>& lines_by_name();
 
@@ -340,24 +658,105 @@ namespace YukiWorkshop::GPIO {
 		void open(uint32_t __id);
 
 		LineSingle line(uint32_t __line_number, LineMode __mode, uint8_t __default_value = 0, const std::string& __label = "");
+		// Both ABIs take at most this many lines per handle
+		static constexpr size_t max_lines_per_handle = 64;
+
+		// These throw if more than max_lines_per_handle lines are requested
 		LineMultiple line(const std::initializer_list<LineSpec>& __lss, LineMode __mode, const std::string& __label = "");
+		LineMultiple line(const std::vector<LineSpec>& __lss, LineMode __mode, const std::string& __label = "");
+		LineMultiple line(const LineSpec *__lss, size_t __count, LineMode __mode, const std::string& __label = "");
+
+		// Any number of lines, split over as many handles as needed
+		LineGroup line_group(const std::vector<LineSpec>& __lss, LineMode __mode, const std::string& __label = "");
+
+		// Subscribes to kernel line info changes of every line and keeps a cache current from
+		// them, so line_info() and LineSingle::mode() stop doing ioctls. Changes are applied by
+		// the event listener (or dispatch_ready()), like events. Lines this device changed
+		// are queried with an ioctl until their change has been applied. Lasts as long as
+		// the device; a watching device can no longer be moved.
+		void watch_line_info();
+
+		bool line_info_watched() const noexcept;
+
+		LineInfo line_info(uint32_t __line);
+
+		// True if the line is in use, but not through any handle or event of this device
+		bool requested_elsewhere(uint32_t __line);
+
+		// Called on the listener thread for every change once watch_line_info() is on
+		int subscribe_line_info(const LineInfoHandler& __handler);
+		void unsubscribe_line_info(int __id);
+
+		// Max events drained from one event fd per read()
+		static constexpr size_t event_batch_size = 64;
+#ifdef GPIOPP_ABI_V2
+		static constexpr size_t event_read_size = event_batch_size * sizeof(gpio_v2_line_event);
+#else
+		static constexpr size_t event_read_size = event_batch_size * sizeof(gpioevent_data);
+#endif
+
+		int add_event(uint32_t __line_number, LineMode __line_mode, EventMode __event_mode,
+			      const EventHandler& __handler, const std::string& __label = "", const EventOptions& __options = {});
 
+		// The batch handler receives every event drained by a single read() at once
 		int add_event(uint32_t __line_number, LineMode __line_mode, EventMode __event_mode,
-			      const std::function<void(EventType, uint64_t)>& __handler, const std::string& __label = "");
+			      const BatchEventHandler& __handler, const std::string& __label = "", const EventOptions& __options = {});
+
+		// Watch a whole bank of lines under one handle. With ABI v2 this costs one fd per 64 lines.
+		int add_event(const std::vector<uint32_t>& __line_numbers, LineMode __line_mode, EventMode __event_mode,
+			      const LineEventHandler& __handler, const std::string& __label = "", const EventOptions& __options = {});
+
+		int add_event(const std::vector<uint32_t>& __line_numbers, LineMode __line_mode, EventMode __event_mode,
+			      const BatchEventHandler& __handler, const std::string& __label = "", const EventOptions& __options = {});
+
+		// Events go straight into __sink, which must outlive the event
+		int add_event(uint32_t __line_number, LineMode __line_mode, EventMode __event_mode,
+			      EventSink& __sink, const std::string& __label = "", const EventOptions& __options = {});
+
+		int add_event(const std::vector<uint32_t>& __line_numbers, LineMode __line_mode, EventMode __event_mode,
+			      EventSink& __sink, const std::string& __label = "", const EventOptions& __options = {});
+
+		// Serve any other readable fd (timerfd, eventfd...) from the same event loop. The device
+		// takes ownership of __fd; whatever one read() returns is passed to __handler.
+		int add_fd_handler(int __fd, const FdHandler& __handler, int __shard = -1);
 
 		void remove_event(int __event_handle);
 
-		void process_event(int __event_handle);
+		// Returns the number of events dispatched, 0 if none were pending
+		size_t process_event(int __event_handle);
+
+		// A single fd that becomes readable whenever any event of this device is pending.
+		// Register it in your own epoll/poll/io_uring loop, then call dispatch_ready().
+		// Don't combine with run_eventlistener().
+		int poll_fd();
+
+		// Dispatches up to __max_events pending events without blocking, returns how many
+		size_t dispatch_ready(size_t __max_events = SIZE_MAX);
 
 		std::vector<int> event_fds();
 
 		bool is_event_fd(int __fd);
 
-		void run_eventlistener();
+		// Blocks until stop_eventlistener(). The calling thread serves shard 0,
+		// extra threads are spawned for the others.
+		void run_eventlistener(const ListenerOptions& __options = {});
 		void stop_eventlistener();
 	};
 
+	typedef std::shared_ptr<LineSingle> SharedLineSingle;
+	typedef std::shared_ptr<LineMultiple> SharedLineMultiple;
+	typedef std::shared_ptr<Device> SharedDevice;
+
+	struct LineLocation {
+		std::string path;
+		uint32_t chip_number;
+		uint32_t offset;
+	};
+
+	// These look chips and lines up in a cached index (see DeviceIndex.hpp) and only open what they return
 	extern std::vector<Device> all_devices();
 	extern GPIO::Device find_device_by_label(const std::string& __label);
 	extern GPIO::Device find_device_by_name(const std::string& __name);
+	// Finds a named line on any chip
+	extern LineLocation find_line_by_name(const std::string& __name);
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "IoUring.hpp"
+
+#ifdef GPIOPP_HAVE_IO_URING
+
+#include <algorithm>
+#include <system_error>
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Utils.hpp"
+
+using namespace YukiWorkshop;
+
+GPIO::IoUring::IoUring(uint32_t __entries) {
+	io_uring_params p{};
+
+	if ((fd = syscall(__NR_io_uring_setup, __entries, &p)) == -1)
+		throw ExceptionWithErrno("failed to setup io_uring");
+
+	features_ = p.features;
+
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+	if (features_ & IORING_FEAT_SINGLE_MMAP)
+		sq_len = cq_len = std::max(sq_len, cq_len);
+
+	sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq_ptr == MAP_FAILED) {
+		int err = errno;
+		close(fd);
+		throw std::system_error(err, std::system_category(), "failed to map io_uring");
+	}
+
+	if (features_ & IORING_FEAT_SINGLE_MMAP) {
+		cq_ptr = sq_ptr;
+	} else {
+		cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq_ptr == MAP_FAILED) {
+			int err = errno;
+			munmap(sq_ptr, sq_len);
+			close(fd);
+			throw std::system_error(err, std::system_category(), "failed to map io_uring");
+		}
+	}
+
+	sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+	sqes = (io_uring_sqe *)mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		int err = errno;
+		if (cq_ptr != sq_ptr)
+			munmap(cq_ptr, cq_len);
+		munmap(sq_ptr, sq_len);
+		close(fd);
+		throw std::system_error(err, std::system_category(), "failed to map io_uring");
+	}
+
+	auto *sq = (uint8_t *)sq_ptr;
+	sq_head = (uint32_t *)(sq + p.sq_off.head);
+	sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	sq_entries = *(uint32_t *)(sq + p.sq_off.ring_entries);
+	sq_array = (uint32_t *)(sq + p.sq_off.array);
+	sq_local_tail = *sq_tail;
+
+	auto *cq = (uint8_t *)cq_ptr;
+	cq_head = (uint32_t *)(cq + p.cq_off.head);
+	cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+GPIO::IoUring::~IoUring() {
+	munmap(sqes, sqes_len);
+	if (cq_ptr != sq_ptr)
+		munmap(cq_ptr, cq_len);
+	munmap(sq_ptr, sq_len);
+	close(fd);
+}
+
+bool GPIO::IoUring::available() noexcept {
+	io_uring_params p{};
+
+	int rfd = syscall(__NR_io_uring_setup, 2, &p);
+	if (rfd == -1)
+		return false;
+
+	close(rfd);
+	return true;
+}
+
+void GPIO::IoUring::register_buffers(const iovec *__iovs, unsigned __count) {
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, __iovs, __count))
+		throw ExceptionWithErrno("failed to register io_uring buffers");
+}
+
+void GPIO::IoUring::reserve(unsigned __count) {
+	if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) + __count > sq_entries)
+		submit();
+}
+
+io_uring_sqe *GPIO::IoUring::get_sqe() {
+	reserve(1);
+
+	uint32_t idx = sq_local_tail & sq_mask;
+	auto *sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	sq_array[idx] = idx;
+	sq_local_tail++;
+	to_submit++;
+
+	return sqe;
+}
+
+void GPIO::IoUring::submit(unsigned __wait_nr) {
+	__atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+
+	while (true) {
+		long rc = syscall(__NR_io_uring_enter, fd, to_submit, __wait_nr, __wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+		if (rc >= 0) {
+			to_submit -= std::min<uint32_t>(rc, to_submit);
+			if (!to_submit || __wait_nr || !rc)
+				return;
+		} else if (errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+			throw ExceptionWithErrno("failed to submit to io_uring");
+		} else if (__wait_nr) {
+			// Interrupted or CQ full: let the caller reap what is there
+			return;
+		}
+	}
+}
+
+#endif
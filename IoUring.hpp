@@ -0,0 +1,94 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#ifdef GPIOPP_HAVE_IO_URING
+
+#include <cstddef>
+#include <cinttypes>
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+namespace YukiWorkshop::GPIO {
+	// Bare minimum io_uring wrapper on raw syscalls, so liburing isn't a dependency
+	class IoUring {
+	private:
+		int fd = -1;
+		uint32_t features_ = 0;
+
+		void *sq_ptr = nullptr, *cq_ptr = nullptr;
+		size_t sq_len = 0, cq_len = 0;
+		io_uring_sqe *sqes = nullptr;
+		size_t sqes_len = 0;
+
+		uint32_t *sq_head, *sq_tail, *sq_array;
+		uint32_t sq_mask, sq_entries;
+		uint32_t *cq_head, *cq_tail;
+		uint32_t cq_mask;
+		io_uring_cqe *cqes;
+
+		uint32_t sq_local_tail = 0;
+		uint32_t to_submit = 0;
+
+	public:
+		explicit IoUring(uint32_t __entries);
+		~IoUring();
+
+		IoUring(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+
+		// Whether the running kernel lets us create a ring at all
+		static bool available() noexcept;
+
+		uint32_t features() const noexcept {
+			return features_;
+		}
+
+		void register_buffers(const iovec *__iovs, unsigned __count);
+
+		// Flushes the queue if fewer than __count SQEs are free, keeps linked SQEs together
+		void reserve(unsigned __count);
+
+		// Zeroed SQE, flushes the queue first if it is full
+		io_uring_sqe *get_sqe();
+
+		// Submits everything queued and waits for at least __wait_nr completions
+		void submit(unsigned __wait_nr = 0);
+
+		// Calls __func(const io_uring_cqe&) for every completion ready, returns how many.
+		// Each CQE is consumed before __func sees it, so one that throws is never seen again.
+		template <typename F>
+		unsigned reap(F __func) {
+			uint32_t head = *cq_head;
+			uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+			unsigned n = 0;
+
+			for (; head != tail; n++) {
+				io_uring_cqe cqe = cqes[head & cq_mask];
+				__atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+				__func(cqe);
+			}
+
+			return n;
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "LineInfoCache.hpp"
+#include "Utils.hpp"
+
+#include <thread>
+
+#include <cstring>
+
+using namespace YukiWorkshop;
+
+static void pack(std::atomic<uint64_t> *__dst, const char *__src) {
+	uint64_t words[4];
+	memcpy(words, __src, sizeof(words));
+
+	for (int i=0; i<4; i++)
+		__dst[i].store(words[i], std::memory_order_relaxed);
+}
+
+static void unpack(char *__dst, const std::atomic<uint64_t> *__src) {
+	uint64_t words[4];
+
+	for (int i=0; i<4; i++)
+		words[i] = __src[i].load(std::memory_order_relaxed);
+
+	memcpy(__dst, words, sizeof(words));
+	__dst[31] = 0;
+}
+
+GPIO::LineInfoCache::LineInfoCache(uint32_t __num_lines) : slots_(new Slot[__num_lines]), num_lines_(__num_lines) {
+
+}
+
+void GPIO::LineInfoCache::store(const LineInfo &__info, uint64_t __ts) {
+	if (__info.offset >= num_lines_)
+		return;
+
+	auto &s = slots_[__info.offset];
+	uint32_t seq = s.seq.load(std::memory_order_relaxed);
+
+	// Odd while writing, readers that see it or a change retry
+	s.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	s.mode.store((int32_t)__info.mode, std::memory_order_relaxed);
+	s.used.store(__info.used, std::memory_order_relaxed);
+	pack(s.name, __info.name);
+	pack(s.consumer, __info.consumer);
+	s.changed_ts.store(__ts, std::memory_order_relaxed);
+
+	s.seq.store(seq + 2, std::memory_order_release);
+}
+
+bool GPIO::LineInfoCache::load(uint32_t __line, LineInfo &__info) const {
+	if (__line >= num_lines_)
+		return false;
+
+	auto &s = slots_[__line];
+	uint32_t seq;
+	uint64_t changed_ts;
+
+	do {
+		while ((seq = s.seq.load(std::memory_order_acquire)) & 1)
+			std::this_thread::yield();
+
+		__info.offset = __line;
+		__info.mode = (LineMode)s.mode.load(std::memory_order_relaxed);
+		__info.used = s.used.load(std::memory_order_relaxed);
+		unpack(__info.name, s.name);
+		unpack(__info.consumer, s.consumer);
+		changed_ts = s.changed_ts.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while (s.seq.load(std::memory_order_relaxed) != seq);
+
+	// The kernel timestamps our own change inside the ioctl, after expect_change()
+	return changed_ts >= s.expected_ts.load(std::memory_order_acquire);
+}
+
+void GPIO::LineInfoCache::expect_change(uint32_t __line) noexcept {
+	if (__line < num_lines_)
+		slots_[__line].expected_ts.store(Utils::monotonic_ns(), std::memory_order_release);
+}
+
+void GPIO::LineInfoCache::acquire(uint32_t __line) noexcept {
+	if (__line < num_lines_)
+		slots_[__line].owned.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GPIO::LineInfoCache::release(uint32_t __line) noexcept {
+	if (__line < num_lines_)
+		slots_[__line].owned.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool GPIO::LineInfoCache::owned(uint32_t __line) const noexcept {
+	return __line < num_lines_ && slots_[__line].owned.load(std::memory_order_relaxed);
+}
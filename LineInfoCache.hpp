@@ -0,0 +1,96 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * Line info of one chip, kept current by the kernel's line info watch
+	 * (see Device::watch_line_info()). There is one writer, the thread that
+	 * handles the watch fd; load() on any thread uses a per-line sequence
+	 * counter and never blocks or enters the kernel.
+	 *
+	 * Changes this process makes reach the cache the same way, some time
+	 * later. Until the watch delivers a change at least as recent as the
+	 * last expect_change() of a line, load() reports that line as stale,
+	 * and Device::line_info() and LineSingle::mode() spend one line info
+	 * ioctl on it instead of returning the old state. Right after a request
+	 * or set_mode(), until the listener (or dispatch_ready()) has caught up,
+	 * queries of those lines cost a syscall like unwatched ones.
+	 *
+	 * Also counts the handles this process holds on each line, so a line
+	 * in use can be told apart from a line in use by someone else.
+	 */
+	class LineInfoCache {
+	private:
+		struct Slot {
+			std::atomic<uint32_t> seq{0};
+			std::atomic<int32_t> mode{0};
+			std::atomic<bool> used{false};
+			std::atomic<uint64_t> name[4] = {};
+			std::atomic<uint64_t> consumer[4] = {};
+			// CLOCK_MONOTONIC time of the info stored, and of the last change we started
+			std::atomic<uint64_t> changed_ts{0};
+			std::atomic<uint64_t> expected_ts{0};
+
+			std::atomic<uint32_t> owned{0};
+		};
+
+		std::unique_ptr<Slot[]> slots_;
+		uint32_t num_lines_;
+		std::atomic<bool> watched_{false};
+
+	public:
+		explicit LineInfoCache(uint32_t __num_lines);
+
+		LineInfoCache(const LineInfoCache&) = delete;
+		LineInfoCache& operator=(const LineInfoCache&) = delete;
+
+		uint32_t num_lines() const noexcept {
+			return num_lines_;
+		}
+
+		// Whether the kernel keeps this cache current
+		bool watched() const noexcept {
+			return watched_.load(std::memory_order_acquire);
+		}
+
+		void set_watched(bool __watched) noexcept {
+			watched_.store(__watched, std::memory_order_release);
+		}
+
+		// Writer side, one thread at a time. __ts is when the line got into this state.
+		void store(const LineInfo& __info, uint64_t __ts);
+
+		// False if the line doesn't exist or is stale
+		bool load(uint32_t __line, LineInfo& __info) const;
+
+		// Call before requesting, reconfiguring or releasing a line
+		void expect_change(uint32_t __line) noexcept;
+
+		// Handle counting, see Device::requested_elsewhere()
+		void acquire(uint32_t __line) noexcept;
+		void release(uint32_t __line) noexcept;
+		bool owned(uint32_t __line) const noexcept;
+	};
+}
@@ -0,0 +1,261 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Pwm.hpp"
+
+using namespace YukiWorkshop;
+
+// Longest single sleep, so stop() and set() are noticed while idle
+static const uint64_t wake_check_ns = 10000000;
+
+GPIO::PwmScheduler::PwmScheduler(const LineMultiple &__lines, const PwmOptions &__options) :
+	lines_(__lines.duplicate()), options_(__options) {
+
+}
+
+GPIO::PwmScheduler::~PwmScheduler() {
+	stop();
+
+	if (thread_.joinable())
+		thread_.join();
+}
+
+void GPIO::PwmScheduler::check_channel(uint8_t __channel) const {
+	if (__channel >= lines_.num_lines())
+		throw std::logic_error("no such PWM channel");
+}
+
+void GPIO::PwmScheduler::set(uint8_t __channel, uint64_t __period_ns, uint64_t __duty_ns) {
+	check_channel(__channel);
+
+	if (!__period_ns)
+		throw std::logic_error("PWM period can't be 0");
+
+	std::lock_guard<std::mutex> lg(config_lock_);
+	auto &p = pending_[__channel];
+	p.period_ns = __period_ns;
+	p.duty_ns = __duty_ns;
+	p.enabled = true;
+	p.changed = true;
+	dirty_ = true;
+}
+
+void GPIO::PwmScheduler::set_frequency(uint8_t __channel, double __hz, double __duty_cycle) {
+	if (__hz <= 0)
+		throw std::logic_error("PWM frequency must be positive");
+
+	uint64_t period = 1e9 / __hz;
+	set(__channel, period, period * std::clamp(__duty_cycle, 0.0, 1.0));
+}
+
+void GPIO::PwmScheduler::disable(uint8_t __channel) {
+	check_channel(__channel);
+
+	std::lock_guard<std::mutex> lg(config_lock_);
+	auto &p = pending_[__channel];
+	p.enabled = false;
+	p.changed = true;
+	dirty_ = true;
+}
+
+void GPIO::PwmScheduler::start() {
+	if (run_ || thread_.joinable())
+		throw std::logic_error("PWM scheduler already started");
+
+	run_ = true;
+	error_ = nullptr;
+
+	thread_ = std::thread([this]{
+		try {
+			run_loop();
+		} catch (...) {
+			error_ = std::current_exception();
+		}
+
+		run_ = false;
+	});
+}
+
+void GPIO::PwmScheduler::stop() {
+	run_ = false;
+}
+
+void GPIO::PwmScheduler::wait() {
+	if (thread_.joinable())
+		thread_.join();
+
+	if (error_) {
+		auto e = error_;
+		error_ = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+GPIO::TimingStats GPIO::PwmScheduler::jitter() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return jitter_;
+}
+
+uint64_t GPIO::PwmScheduler::edges() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return edges_;
+}
+
+uint64_t GPIO::PwmScheduler::writes() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return writes_;
+}
+
+void GPIO::PwmScheduler::apply_pending(uint64_t __now) {
+	uint64_t low_mask = 0;
+
+	{
+		std::lock_guard<std::mutex> lg(config_lock_);
+
+		for (uint8_t i=0; i<lines_.num_lines(); i++) {
+			auto &p = pending_[i];
+			if (!p.changed)
+				continue;
+
+			p.changed = false;
+			auto &ch = channels_[i];
+
+			if (!p.enabled) {
+				if (ch.enabled)
+					low_mask |= 1ULL << i;
+
+				ch = Channel();
+				continue;
+			}
+
+			bool was_running = ch.enabled && ch.next_edge != UINT64_MAX;
+
+			ch.period_ns = p.period_ns;
+			ch.duty_ns = p.duty_ns;
+			ch.enabled = true;
+
+			if (was_running && p.duty_ns && p.duty_ns < p.period_ns) {
+				// Keep the phase, a passed edge fires right away
+				ch.next_edge = ch.on ? ch.period_start + ch.duty_ns : ch.period_start + ch.period_ns;
+			} else {
+				ch.on = false;
+				ch.next_edge = __now;
+			}
+		}
+	}
+
+	if (low_mask)
+		lines_.write_masked(0, low_mask);
+}
+
+void GPIO::PwmScheduler::advance(Channel &__ch, uint64_t __now) {
+	if (!__ch.duty_ns) {
+		__ch.on = false;
+		__ch.next_edge = UINT64_MAX;
+	} else if (__ch.duty_ns >= __ch.period_ns) {
+		__ch.on = true;
+		__ch.next_edge = UINT64_MAX;
+	} else if (!__ch.on) {
+		// Periods are laid out from the scheduled edge, not from when it
+		// actually fired, so lateness doesn't accumulate. After falling
+		// more than a period behind, start over from now.
+		__ch.period_start = __now > __ch.next_edge && __now - __ch.next_edge > __ch.period_ns ? __now : __ch.next_edge;
+		__ch.on = true;
+		__ch.next_edge = __ch.period_start + __ch.duty_ns;
+	} else {
+		__ch.on = false;
+		__ch.next_edge = __ch.period_start + __ch.period_ns;
+	}
+}
+
+bool GPIO::PwmScheduler::wait_until(uint64_t __deadline_ns) {
+	while (run_.load(std::memory_order_relaxed)) {
+		if (dirty_.load(std::memory_order_relaxed))
+			return false;
+
+		uint64_t now = Utils::monotonic_ns();
+
+		if (__deadline_ns <= now + options_.spin_ns + wake_check_ns) {
+			Utils::sleep_until_ns(__deadline_ns, options_.spin_ns);
+			return true;
+		}
+
+		Utils::sleep_until_ns(now + wake_check_ns);
+	}
+
+	return false;
+}
+
+void GPIO::PwmScheduler::run_loop() {
+	if (options_.cpu >= 0)
+		Utils::set_thread_affinity(options_.cpu);
+
+	if (options_.rt_priority > 0)
+		Utils::set_thread_realtime(options_.rt_priority);
+
+	uint8_t n = lines_.num_lines();
+
+	while (run_.load(std::memory_order_relaxed)) {
+		if (dirty_.exchange(false))
+			apply_pending(Utils::monotonic_ns());
+
+		uint64_t due = UINT64_MAX;
+		for (uint8_t i=0; i<n; i++)
+			due = std::min(due, channels_[i].next_edge);
+
+		if (due == UINT64_MAX) {
+			wait_until(Utils::monotonic_ns() + wake_check_ns);
+			continue;
+		}
+
+		if (!wait_until(due))
+			continue;
+
+		uint64_t now = Utils::monotonic_ns();
+		uint64_t bits = 0, mask = 0;
+		uint64_t cnt = 0;
+
+		for (uint8_t i=0; i<n; i++) {
+			auto &ch = channels_[i];
+
+			if (ch.next_edge <= now + options_.coalesce_ns) {
+				advance(ch, now);
+				mask |= 1ULL << i;
+				if (ch.on)
+					bits |= 1ULL << i;
+				cnt++;
+			}
+		}
+
+		lines_.write_masked(bits, mask);
+
+		std::lock_guard<std::mutex> lg(stats_lock_);
+		jitter_.add((int64_t)(now - due));
+		edges_ += cnt;
+		writes_++;
+	}
+
+	uint64_t enabled = 0;
+	for (uint8_t i=0; i<n; i++) {
+		if (channels_[i].enabled)
+			enabled |= 1ULL << i;
+	}
+
+	if (enabled)
+		lines_.write_masked(0, enabled);
+}
@@ -0,0 +1,120 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	struct PwmOptions {
+		// Edges due within this window of each other are written together
+		uint64_t coalesce_ns = 1000;
+		// Busy-wait this long before each edge instead of sleeping
+		uint64_t spin_ns = 20000;
+		// SCHED_FIFO priority of the timing thread, 0 to leave it alone
+		int rt_priority = 0;
+		// CPU to pin the timing thread to, -1 for none
+		int cpu = -1;
+	};
+
+	/*
+	 * Software PWM on every line of a LineMultiple from a single thread.
+	 * Channel i is line i. All edges due at the same time go out as one
+	 * write_masked(), so N channels in phase cost one ioctl per edge.
+	 *
+	 * set()/disable() may be called from any thread while running.
+	 */
+	class PwmScheduler {
+	private:
+		struct Channel {
+			uint64_t period_ns = 0, duty_ns = 0;
+			bool enabled = false;
+			bool on = false;
+			uint64_t period_start = 0;
+			uint64_t next_edge = UINT64_MAX;
+		};
+
+		struct Pending {
+			uint64_t period_ns = 0, duty_ns = 0;
+			bool enabled = false;
+			bool changed = false;
+		};
+
+		LineMultiple lines_;
+		PwmOptions options_;
+
+		// Owned by the timing thread
+		Channel channels_[64];
+
+		std::mutex config_lock_;
+		Pending pending_[64];
+		std::atomic<bool> dirty_{false};
+
+		std::thread thread_;
+		std::atomic<bool> run_{false};
+		std::exception_ptr error_;
+
+		mutable std::mutex stats_lock_;
+		TimingStats jitter_;
+		uint64_t edges_ = 0, writes_ = 0;
+
+		void apply_pending(uint64_t __now);
+		void advance(Channel& __ch, uint64_t __now);
+		bool wait_until(uint64_t __deadline_ns);
+		void run_loop();
+		void check_channel(uint8_t __channel) const;
+	public:
+		explicit PwmScheduler(const LineMultiple& __lines, const PwmOptions& __options = {});
+		~PwmScheduler();
+
+		PwmScheduler(const PwmScheduler&) = delete;
+		PwmScheduler& operator=(const PwmScheduler&) = delete;
+
+		uint8_t num_channels() const noexcept {
+			return lines_.num_lines();
+		}
+
+		// A duty of 0 holds the line low, a duty >= period holds it high.
+		// Changes to a running channel keep its phase.
+		void set(uint8_t __channel, uint64_t __period_ns, uint64_t __duty_ns);
+		void set_frequency(uint8_t __channel, double __hz, double __duty_cycle);
+		// Drives the line low and stops scheduling it
+		void disable(uint8_t __channel);
+
+		void start();
+		// Stops the thread and drives every enabled channel low
+		void stop();
+		// Rethrows anything the timing thread threw
+		void wait();
+
+		bool running() const noexcept {
+			return run_.load();
+		}
+
+		// How late each write started relative to the earliest edge in it
+		TimingStats jitter() const;
+		// Edges produced, and writes used for them
+		uint64_t edges() const;
+		uint64_t writes() const;
+	};
+}
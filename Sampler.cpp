@@ -0,0 +1,269 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Sampler.hpp"
+
+using namespace YukiWorkshop;
+
+// Longest single sleep, so stop() is noticed at low rates
+static const uint64_t stop_check_ns = 10000000;
+
+static GPIO::LineGroup group_of(const GPIO::LineMultiple &__lines) {
+	GPIO::LineGroup ret;
+	ret.add(__lines);
+	return ret;
+}
+
+GPIO::Sampler::Sampler(const LineMultiple &__lines, std::vector<uint32_t> __line_numbers, const SamplerOptions &__options) :
+	Sampler(group_of(__lines), std::move(__line_numbers), __options) {
+
+}
+
+GPIO::Sampler::Sampler(const LineGroup &__group, std::vector<uint32_t> __line_numbers, const SamplerOptions &__options) :
+	Sampler(__group.duplicate(), std::move(__line_numbers), __options) {
+
+}
+
+GPIO::Sampler::Sampler(LineGroup &&__group, std::vector<uint32_t> __line_numbers, const SamplerOptions &__options) :
+	group_(std::move(__group)), line_numbers_(std::move(__line_numbers)), options_(__options), words_(group_.num_words()) {
+	if (!group_.num_lines())
+		throw std::logic_error("nothing to sample");
+
+	if (!options_.period_ns)
+		throw std::logic_error("sampling period can't be 0");
+
+	if (line_numbers_.empty()) {
+		for (uint32_t i=0; i<group_.num_lines(); i++)
+			line_numbers_.push_back(i);
+	} else if (line_numbers_.size() != group_.num_lines()) {
+		throw std::logic_error("line number count doesn't match line count");
+	}
+
+	size_t cap = 1;
+	while (cap < options_.history)
+		cap <<= 1;
+
+	samples_.resize(cap * words_);
+	sample_ts_.resize(cap);
+	ring_mask_ = cap - 1;
+
+	prev_.resize(words_);
+	cur_.resize(words_);
+	events_.resize(group_.num_lines());
+}
+
+GPIO::Sampler::~Sampler() {
+	stop();
+
+	if (thread_.joinable())
+		thread_.join();
+}
+
+void GPIO::Sampler::add_event(uint32_t __line_number, EventMode __mode, const EventHandler &__handler) {
+	auto it = std::find(line_numbers_.begin(), line_numbers_.end(), __line_number);
+	if (it == line_numbers_.end())
+		throw std::logic_error("line is not sampled");
+
+	line_handlers_.push_back({(size_t)(it - line_numbers_.begin()), __mode, __handler});
+}
+
+void GPIO::Sampler::set_handler(const BatchEventHandler &__handler) {
+	batch_handler_ = __handler;
+}
+
+void GPIO::Sampler::set_sink(EventSink &__sink) {
+	sink_ = &__sink;
+}
+
+void GPIO::Sampler::start() {
+	if (run_ || thread_.joinable())
+		throw std::logic_error("sampler already started");
+
+	run_ = true;
+	error_ = nullptr;
+
+	thread_ = std::thread([this]{
+		try {
+			sample_loop();
+		} catch (...) {
+			error_ = std::current_exception();
+		}
+
+		run_ = false;
+	});
+}
+
+void GPIO::Sampler::stop() {
+	run_ = false;
+}
+
+void GPIO::Sampler::wait() {
+	if (thread_.joinable())
+		thread_.join();
+
+	if (error_) {
+		auto e = error_;
+		error_ = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+size_t GPIO::Sampler::read_samples(uint64_t *__words, uint64_t *__timestamps, size_t __max) {
+	uint64_t tail = tail_.load(std::memory_order_relaxed);
+	uint64_t head = head_.load(std::memory_order_acquire);
+	size_t n = std::min<uint64_t>(head - tail, __max);
+
+	for (size_t i=0; i<n; i++) {
+		uint64_t slot = (tail + i) & ring_mask_;
+		memcpy(__words + i * words_, &samples_[slot * words_], words_ * sizeof(uint64_t));
+		__timestamps[i] = sample_ts_[slot];
+	}
+
+	tail_.store(tail + n, std::memory_order_release);
+	return n;
+}
+
+GPIO::TimingStats GPIO::Sampler::lateness() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return lateness_;
+}
+
+uint64_t GPIO::Sampler::taken() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return taken_;
+}
+
+uint64_t GPIO::Sampler::missed() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return missed_;
+}
+
+uint64_t GPIO::Sampler::overruns() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return overruns_;
+}
+
+bool GPIO::Sampler::wait_until(uint64_t __deadline_ns) {
+	while (run_.load(std::memory_order_relaxed)) {
+		uint64_t now = Utils::monotonic_ns();
+
+		if (__deadline_ns <= now + options_.spin_ns + stop_check_ns) {
+			Utils::sleep_until_ns(__deadline_ns, options_.spin_ns);
+			return true;
+		}
+
+		Utils::sleep_until_ns(now + stop_check_ns);
+	}
+
+	return false;
+}
+
+void GPIO::Sampler::detect(uint64_t __ts) {
+	size_t n = 0;
+
+	for (size_t w=0; w<words_; w++) {
+		uint64_t diff = prev_[w] ^ cur_[w];
+
+		while (diff) {
+			unsigned b = __builtin_ctzll(diff);
+			diff &= diff - 1;
+
+			size_t idx = w * 64 + b;
+			auto &ev = events_[n++];
+			ev.type = (cur_[w] >> b) & 1 ? EventType::RisingEdge : EventType::FallingEdge;
+			ev.timestamp = __ts;
+			ev.line = line_numbers_[idx];
+			ev.seqno = ++seqno_;
+			ev.line_seqno = 0;
+		}
+	}
+
+	if (!n)
+		return;
+
+	if (batch_handler_)
+		batch_handler_(events_.data(), n);
+
+	if (sink_)
+		sink_->consume(events_.data(), n);
+
+	for (auto &it : line_handlers_) {
+		size_t w = it.index / 64, b = it.index % 64;
+
+		if (!(((prev_[w] ^ cur_[w]) >> b) & 1))
+			continue;
+
+		auto type = (cur_[w] >> b) & 1 ? EventType::RisingEdge : EventType::FallingEdge;
+		if (((int)it.mode & (int)type) == (int)type)
+			it.handler(type, __ts);
+	}
+}
+
+void GPIO::Sampler::sample_loop() {
+	if (options_.cpu >= 0)
+		Utils::set_thread_affinity(options_.cpu);
+
+	if (options_.rt_priority > 0)
+		Utils::set_thread_realtime(options_.rt_priority);
+
+	bool first = true;
+	uint64_t t0 = Utils::monotonic_ns();
+
+	for (uint64_t k=0; ; k++) {
+		uint64_t deadline = t0 + k * options_.period_ns;
+
+		if (!wait_until(deadline))
+			return;
+
+		uint64_t t = Utils::monotonic_ns();
+		group_.read_bits(cur_.data());
+		uint64_t t2 = Utils::monotonic_ns();
+
+		// The lines were read somewhere in between
+		uint64_t ts = t + (t2 - t) / 2;
+
+		uint64_t head = head_.load(std::memory_order_relaxed);
+		bool overrun = head - tail_.load(std::memory_order_acquire) > ring_mask_;
+		if (!overrun) {
+			uint64_t slot = head & ring_mask_;
+			memcpy(&samples_[slot * words_], cur_.data(), words_ * sizeof(uint64_t));
+			sample_ts_[slot] = ts;
+			head_.store(head + 1, std::memory_order_release);
+		}
+
+		if (!first)
+			detect(ts);
+
+		first = false;
+		prev_.swap(cur_);
+
+		// Resync to the next slot still ahead instead of firing the missed ones back to back
+		uint64_t skip = 0;
+		uint64_t now = Utils::monotonic_ns();
+		if (now > deadline + options_.period_ns) {
+			skip = (now - deadline) / options_.period_ns;
+			k += skip;
+		}
+
+		std::lock_guard<std::mutex> lg(stats_lock_);
+		lateness_.add((int64_t)(t - deadline));
+		taken_++;
+		missed_ += skip;
+		overruns_ += overrun;
+	}
+}
@@ -0,0 +1,130 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	struct SamplerOptions {
+		uint64_t period_ns = 1000000;
+		// Samples buffered for read_samples(), rounded up to a power of 2
+		size_t history = 1024;
+		// Busy-wait this long before each sample instead of sleeping
+		uint64_t spin_ns = 20000;
+		// SCHED_FIFO priority of the sampling thread, 0 to leave it alone
+		int rt_priority = 0;
+		// CPU to pin the sampling thread to, -1 for none
+		int cpu = -1;
+	};
+
+	/*
+	 * Reads a LineGroup at a fixed rate, for lines that can't raise edge
+	 * interrupts. Samples are taken at absolute times, so the rate doesn't
+	 * drift; slots missed by more than a period are skipped, not bunched.
+	 *
+	 * Changes between two samples become Events, delivered the same way
+	 * Device::add_event() delivers kernel edges. Handlers must be set
+	 * before start() and run on the sampling thread.
+	 */
+	class Sampler {
+	private:
+		LineGroup group_;
+		std::vector<uint32_t> line_numbers_;
+		SamplerOptions options_;
+		size_t words_;
+
+		BatchEventHandler batch_handler_;
+		EventSink *sink_ = nullptr;
+
+		struct LineHandler {
+			size_t index;
+			EventMode mode;
+			EventHandler handler;
+		};
+		std::vector<LineHandler> line_handlers_;
+
+		// SPSC ring of samples, words_ words each
+		std::vector<uint64_t> samples_;
+		std::vector<uint64_t> sample_ts_;
+		uint64_t ring_mask_;
+		alignas(64) std::atomic<uint64_t> head_{0};
+		alignas(64) std::atomic<uint64_t> tail_{0};
+
+		std::vector<uint64_t> prev_, cur_;
+		std::vector<Event> events_;
+		uint32_t seqno_ = 0;
+
+		std::thread thread_;
+		std::atomic<bool> run_{false};
+		std::exception_ptr error_;
+
+		mutable std::mutex stats_lock_;
+		TimingStats lateness_;
+		uint64_t taken_ = 0, missed_ = 0, overruns_ = 0;
+
+		bool wait_until(uint64_t __deadline_ns);
+		void sample_loop();
+		void detect(uint64_t __ts);
+	public:
+		// __line_numbers gives Event::line for each line of the group, empty for the index in the group
+		Sampler(LineGroup&& __group, std::vector<uint32_t> __line_numbers = {}, const SamplerOptions& __options = {});
+		// Duplicates the handles of __group
+		Sampler(const LineGroup& __group, std::vector<uint32_t> __line_numbers = {}, const SamplerOptions& __options = {});
+		Sampler(const LineMultiple& __lines, std::vector<uint32_t> __line_numbers = {}, const SamplerOptions& __options = {});
+		~Sampler();
+
+		Sampler(const Sampler&) = delete;
+		Sampler& operator=(const Sampler&) = delete;
+
+		void add_event(uint32_t __line_number, EventMode __mode, const EventHandler& __handler);
+		void set_handler(const BatchEventHandler& __handler);
+		void set_sink(EventSink& __sink);
+
+		void start();
+		void stop();
+		// Rethrows anything the sampling thread, or a handler, threw
+		void wait();
+
+		bool running() const noexcept {
+			return run_.load();
+		}
+
+		// Words per sample, see LineGroup::read_bits()
+		size_t num_words() const noexcept {
+			return words_;
+		}
+
+		// Pops up to __max samples, oldest first. __words gets num_words() words
+		// per sample, __timestamps one CLOCK_MONOTONIC ns value per sample.
+		size_t read_samples(uint64_t *__words, uint64_t *__timestamps, size_t __max);
+
+		// How late each read started relative to its slot
+		TimingStats lateness() const;
+		uint64_t taken() const;
+		// Slots skipped because the thread fell more than a period behind
+		uint64_t missed() const;
+		// Samples not buffered because read_samples() didn't keep up
+		uint64_t overruns() const;
+	};
+}
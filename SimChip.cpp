@@ -0,0 +1,758 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SimChip.hpp"
+#include "DeviceIndex.hpp"
+
+#include <algorithm>
+
+#include <sys/socket.h>
+
+using namespace YukiWorkshop;
+
+namespace {
+	// Not every v2 header carries it
+	constexpr uint64_t v2_flag_event_clock_realtime = 1ULL << 11;
+
+	uint64_t realtime_ns() {
+		timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	void set_nonblock(int __fd) {
+		fcntl(__fd, F_SETFL, fcntl(__fd, F_GETFL) | O_NONBLOCK);
+	}
+}
+
+struct GPIO::SimBackend::File {
+	bool is_chip = false;
+	uint32_t chip = 0;
+	// Our end of the pipe or socket, records for the reader go here
+	int wfd = -1;
+
+	// Line requests
+	bool v2 = false;
+	bool event = false;
+	bool realtime = false;
+	std::vector<uint32_t> offsets;
+	std::vector<LineConf> confs;
+	std::vector<uint32_t> line_seqnos;
+	uint32_t seqno = 0;
+	std::string consumer;
+
+	// Chip fds: watched lines and the ABI of the records they get
+	std::vector<bool> watched;
+	int watch_abi = 0;
+
+	~File() {
+		if (wfd != -1)
+			::close(wfd);
+	}
+};
+
+GPIO::SimBackend::~SimBackend() {
+	// The read ends belong to whoever opened them, ours close with the files
+	files_.clear();
+}
+
+uint32_t GPIO::SimBackend::add_chip(const std::string &__label, uint32_t __num_lines, const std::vector<std::string> &__line_names) {
+	uint32_t idx;
+
+	{
+		std::lock_guard<std::mutex> lg(lock_);
+
+		idx = chips_.size();
+		chips_.emplace_back();
+
+		auto &c = chips_.back();
+		c.name = "gpiochip" + std::to_string(idx);
+		c.path = "/sim/" + c.name;
+		c.label = __label;
+		c.lines.resize(__num_lines);
+
+		for (size_t i=0; i<__line_names.size() && i<__num_lines; i++)
+			c.lines[i].name = __line_names[i];
+	}
+
+	if (Sys::current() == this)
+		DeviceIndex::instance().invalidate();
+
+	return idx;
+}
+
+std::string GPIO::SimBackend::path(uint32_t __chip) const {
+	std::lock_guard<std::mutex> lg(lock_);
+
+	if (__chip >= chips_.size())
+		throw std::out_of_range("no such simulated chip");
+
+	return chips_[__chip].path;
+}
+
+uint8_t GPIO::SimBackend::physical(const Chip &__chip, uint32_t __line) const {
+	auto &l = __chip.lines[__line];
+
+	if (l.owner && (l.owner->confs[l.index].flags & GPIOHANDLE_REQUEST_OUTPUT))
+		return l.output;
+
+	return l.input;
+}
+
+uint8_t GPIO::SimBackend::logical(const File &__file, uint32_t __idx) const {
+	uint8_t v = physical(chips_[__file.chip], __file.offsets[__idx]);
+	return (__file.confs[__idx].flags & GPIOHANDLE_REQUEST_ACTIVE_LOW) ? !v : v;
+}
+
+void GPIO::SimBackend::set_input(uint32_t __chip, uint32_t __line, uint8_t __value) {
+	std::lock_guard<std::mutex> lg(lock_);
+
+	if (__chip >= chips_.size() || __line >= chips_[__chip].lines.size())
+		throw std::out_of_range("no such simulated line");
+
+	auto &c = chips_[__chip];
+	auto &l = c.lines[__line];
+	uint8_t old = physical(c, __line);
+
+	l.input = __value ? 1 : 0;
+
+	File *f = l.owner;
+	if (!f || !f->event || physical(c, __line) == old)
+		return;
+
+	auto &conf = f->confs[l.index];
+	uint8_t now = logical(*f, l.index);
+
+	if (!(now ? conf.rising : conf.falling))
+		return;
+
+	uint64_t ts = f->realtime ? realtime_ns() : Utils::monotonic_ns();
+	f->seqno++;
+	f->line_seqnos[l.index]++;
+
+#ifdef GPIOPP_ABI_V2
+	if (f->v2) {
+		gpio_v2_line_event ev{};
+		ev.timestamp_ns = ts;
+		ev.id = now ? GPIO_V2_LINE_EVENT_RISING_EDGE : GPIO_V2_LINE_EVENT_FALLING_EDGE;
+		ev.offset = __line;
+		ev.seqno = f->seqno;
+		ev.line_seqno = f->line_seqnos[l.index];
+		queue(f->wfd, &ev, sizeof(ev));
+		return;
+	}
+#endif
+
+	gpioevent_data ev{};
+	ev.timestamp = ts;
+	ev.id = now ? GPIOEVENT_EVENT_RISING_EDGE : GPIOEVENT_EVENT_FALLING_EDGE;
+	queue(f->wfd, &ev, sizeof(ev));
+}
+
+uint8_t GPIO::SimBackend::level(uint32_t __chip, uint32_t __line) const {
+	std::lock_guard<std::mutex> lg(lock_);
+
+	if (__chip >= chips_.size() || __line >= chips_[__chip].lines.size())
+		throw std::out_of_range("no such simulated line");
+
+	return physical(chips_[__chip], __line);
+}
+
+uint64_t GPIO::SimBackend::dropped_events() const {
+	std::lock_guard<std::mutex> lg(lock_);
+	return dropped_;
+}
+
+void GPIO::SimBackend::queue(int __fd, const void *__rec, size_t __len) {
+	// Records are far below PIPE_BUF, so a write lands whole or not at all
+	if (write(__fd, __rec, __len) != (ssize_t)__len)
+		dropped_++;
+}
+
+void GPIO::SimBackend::line_info_v1(const Chip &__chip, uint32_t __line, gpioline_info &__info) const {
+	auto &l = __chip.lines[__line];
+
+	__info = {};
+	__info.line_offset = __line;
+	strncpy(__info.name, l.name.c_str(), sizeof(__info.name)-1);
+
+	if (!l.owner)
+		return;
+
+	uint32_t flags = l.owner->confs[l.index].flags;
+
+	static const std::pair<uint32_t, uint32_t> table[] = {
+		{GPIOHANDLE_REQUEST_OUTPUT, GPIOLINE_FLAG_IS_OUT},
+		{GPIOHANDLE_REQUEST_ACTIVE_LOW, GPIOLINE_FLAG_ACTIVE_LOW},
+		{GPIOHANDLE_REQUEST_OPEN_DRAIN, GPIOLINE_FLAG_OPEN_DRAIN},
+		{GPIOHANDLE_REQUEST_OPEN_SOURCE, GPIOLINE_FLAG_OPEN_SOURCE},
+#ifdef GPIOLINE_FLAG_BIAS_DISABLE
+		{GPIOHANDLE_REQUEST_BIAS_DISABLE, GPIOLINE_FLAG_BIAS_DISABLE},
+		{GPIOHANDLE_REQUEST_BIAS_PULL_UP, GPIOLINE_FLAG_BIAS_PULL_UP},
+		{GPIOHANDLE_REQUEST_BIAS_PULL_DOWN, GPIOLINE_FLAG_BIAS_PULL_DOWN},
+#endif
+	};
+
+	__info.flags = GPIOLINE_FLAG_KERNEL;
+	for (auto &it : table) {
+		if (flags & it.first)
+			__info.flags |= it.second;
+	}
+
+	strncpy(__info.consumer, l.owner->consumer.c_str(), sizeof(__info.consumer)-1);
+}
+
+#ifdef GPIOPP_ABI_V2
+static const std::pair<uint32_t, uint64_t> v2_flag_table[] = {
+	{GPIOHANDLE_REQUEST_INPUT, GPIO_V2_LINE_FLAG_INPUT},
+	{GPIOHANDLE_REQUEST_OUTPUT, GPIO_V2_LINE_FLAG_OUTPUT},
+	{GPIOHANDLE_REQUEST_ACTIVE_LOW, GPIO_V2_LINE_FLAG_ACTIVE_LOW},
+	{GPIOHANDLE_REQUEST_OPEN_DRAIN, GPIO_V2_LINE_FLAG_OPEN_DRAIN},
+	{GPIOHANDLE_REQUEST_OPEN_SOURCE, GPIO_V2_LINE_FLAG_OPEN_SOURCE},
+	{GPIOHANDLE_REQUEST_BIAS_DISABLE, GPIO_V2_LINE_FLAG_BIAS_DISABLED},
+	{GPIOHANDLE_REQUEST_BIAS_PULL_UP, GPIO_V2_LINE_FLAG_BIAS_PULL_UP},
+	{GPIOHANDLE_REQUEST_BIAS_PULL_DOWN, GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN},
+};
+
+void GPIO::SimBackend::line_info_v2(const Chip &__chip, uint32_t __line, gpio_v2_line_info &__info) const {
+	auto &l = __chip.lines[__line];
+
+	__info = {};
+	__info.offset = __line;
+	strncpy(__info.name, l.name.c_str(), sizeof(__info.name)-1);
+
+	if (!l.owner) {
+		__info.flags = GPIO_V2_LINE_FLAG_INPUT;
+		return;
+	}
+
+	auto &conf = l.owner->confs[l.index];
+
+	__info.flags = GPIO_V2_LINE_FLAG_USED;
+	for (auto &it : v2_flag_table) {
+		if (conf.flags & it.first)
+			__info.flags |= it.second;
+	}
+
+	if (conf.rising)
+		__info.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+	if (conf.falling)
+		__info.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	if (l.owner->realtime)
+		__info.flags |= v2_flag_event_clock_realtime;
+
+	strncpy(__info.consumer, l.owner->consumer.c_str(), sizeof(__info.consumer)-1);
+}
+
+int GPIO::SimBackend::parse_config(const gpio_v2_line_config &__config, size_t __count, LineConf *__confs, uint64_t &__values, bool &__realtime) {
+	__values = 0;
+	__realtime = __config.flags & v2_flag_event_clock_realtime;
+
+	for (size_t i=0; i<__count; i++) {
+		uint64_t flags = __config.flags;
+
+		for (uint32_t j=0; j<__config.num_attrs && j<GPIO_V2_LINE_NUM_ATTRS_MAX; j++) {
+			auto &a = __config.attrs[j];
+			if (!(a.mask & (1ULL << i)))
+				continue;
+
+			if (a.attr.id == GPIO_V2_LINE_ATTR_ID_FLAGS)
+				flags = a.attr.flags;
+			else if (a.attr.id == GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES && (a.attr.values & (1ULL << i)))
+				__values |= 1ULL << i;
+		}
+
+		auto &c = __confs[i];
+		c = {};
+		for (auto &it : v2_flag_table) {
+			if (flags & it.second)
+				c.flags |= it.first;
+		}
+
+		c.rising = flags & GPIO_V2_LINE_FLAG_EDGE_RISING;
+		c.falling = flags & GPIO_V2_LINE_FLAG_EDGE_FALLING;
+
+		if ((c.flags & GPIOHANDLE_REQUEST_INPUT) && (c.flags & GPIOHANDLE_REQUEST_OUTPUT))
+			return EINVAL;
+		if ((c.rising || c.falling) && !(c.flags & GPIOHANDLE_REQUEST_INPUT))
+			return EINVAL;
+	}
+
+	return 0;
+}
+#endif
+
+void GPIO::SimBackend::configure(File &__file, const LineConf *__confs, uint64_t __values) {
+	auto &c = chips_[__file.chip];
+
+	for (size_t i=0; i<__file.offsets.size(); i++) {
+		__file.confs[i] = __confs[i];
+
+		// Output values are logical, like the kernel's
+		if (__confs[i].flags & GPIOHANDLE_REQUEST_OUTPUT) {
+			uint8_t v = (__values >> i) & 1;
+			c.lines[__file.offsets[i]].output = (__confs[i].flags & GPIOHANDLE_REQUEST_ACTIVE_LOW) ? !v : v;
+		}
+	}
+}
+
+int GPIO::SimBackend::request(File &__chip_file, const uint32_t *__offsets, size_t __count, const LineConf *__confs, uint64_t __values,
+			      const char *__consumer, bool __v2, bool __event, bool __realtime, int &__fd) {
+	auto &c = chips_[__chip_file.chip];
+
+	if (!__count || __count > 64)
+		return EINVAL;
+
+	for (size_t i=0; i<__count; i++) {
+		if (__offsets[i] >= c.lines.size() || std::count(__offsets, __offsets + __count, __offsets[i]) > 1)
+			return EINVAL;
+		if (c.lines[__offsets[i]].owner)
+			return EBUSY;
+	}
+
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC))
+		return errno;
+
+	set_nonblock(fds[1]);
+	// Room for bursts, like a generous kernel event buffer. Best effort.
+	fcntl(fds[1], F_SETPIPE_SZ, 1 << 20);
+
+	auto f = std::make_shared<File>();
+	f->chip = __chip_file.chip;
+	f->wfd = fds[1];
+	f->v2 = __v2;
+	f->event = __event;
+	f->realtime = __realtime;
+	f->offsets.assign(__offsets, __offsets + __count);
+	f->confs.resize(__count);
+	f->line_seqnos.resize(__count);
+	f->consumer = std::string(__consumer, strnlen(__consumer, 31));
+
+	configure(*f, __confs, __values);
+
+	for (size_t i=0; i<__count; i++) {
+		auto &l = c.lines[__offsets[i]];
+		l.owner = f.get();
+		l.index = i;
+	}
+
+	files_[fds[0]] = f;
+	__fd = fds[0];
+
+	for (size_t i=0; i<__count; i++)
+		notify(c, __offsets[i], GPIOLINE_CHANGED_REQUESTED);
+
+	return 0;
+}
+
+void GPIO::SimBackend::release(File &__file) {
+	auto &c = chips_[__file.chip];
+
+	if (__file.is_chip) {
+		c.files.erase(std::remove(c.files.begin(), c.files.end(), &__file), c.files.end());
+		return;
+	}
+
+	for (auto it : __file.offsets)
+		c.lines[it].owner = nullptr;
+
+	for (auto it : __file.offsets)
+		notify(c, it, GPIOLINE_CHANGED_RELEASED);
+}
+
+int GPIO::SimBackend::watch(File &__file, uint32_t __line, int __abi) {
+	if (__line >= __file.watched.size())
+		return EINVAL;
+	// The kernel ties a chip fd to the ABI of its first watch
+	if (__file.watch_abi && __file.watch_abi != __abi)
+		return EPERM;
+	if (__file.watched[__line])
+		return EBUSY;
+
+	__file.watch_abi = __abi;
+	__file.watched[__line] = true;
+	return 0;
+}
+
+void GPIO::SimBackend::notify(const Chip &__chip, uint32_t __line, uint32_t __type) {
+	uint64_t ts = Utils::monotonic_ns();
+
+	for (auto *f : __chip.files) {
+		if (!f->watched[__line])
+			continue;
+
+#ifdef GPIOPP_ABI_V2
+		if (f->watch_abi == 2) {
+			gpio_v2_line_info_changed chg{};
+			line_info_v2(__chip, __line, chg.info);
+			chg.timestamp_ns = ts;
+			chg.event_type = __type;
+			queue(f->wfd, &chg, sizeof(chg));
+			continue;
+		}
+#endif
+
+#ifdef GPIOPP_HAVE_LINEINFO_WATCH
+		gpioline_info_changed chg{};
+		line_info_v1(__chip, __line, chg.info);
+		chg.timestamp = ts;
+		chg.event_type = __type;
+		queue(f->wfd, &chg, sizeof(chg));
+#endif
+	}
+}
+
+int GPIO::SimBackend::chip_ioctl(File &__file, unsigned long __request, void *__arg) {
+	auto &c = chips_[__file.chip];
+
+	switch (__request) {
+		case GPIO_GET_CHIPINFO_IOCTL: {
+			auto *ci = static_cast<gpiochip_info *>(__arg);
+			*ci = {};
+			strncpy(ci->name, c.name.c_str(), sizeof(ci->name)-1);
+			strncpy(ci->label, c.label.c_str(), sizeof(ci->label)-1);
+			ci->lines = c.lines.size();
+			return 0;
+		}
+
+		case GPIO_GET_LINEINFO_IOCTL: {
+			auto *li = static_cast<gpioline_info *>(__arg);
+			if (li->line_offset >= c.lines.size())
+				return EINVAL;
+
+			line_info_v1(c, li->line_offset, *li);
+			return 0;
+		}
+
+#ifdef GPIOPP_HAVE_LINEINFO_WATCH
+		case GPIO_GET_LINEINFO_WATCH_IOCTL: {
+			auto *li = static_cast<gpioline_info *>(__arg);
+			if (int err = watch(__file, li->line_offset, 1))
+				return err;
+
+			line_info_v1(c, li->line_offset, *li);
+			return 0;
+		}
+
+		case GPIO_GET_LINEINFO_UNWATCH_IOCTL: {
+			uint32_t line = *static_cast<uint32_t *>(__arg);
+			if (line >= __file.watched.size() || !__file.watched[line])
+				return EBUSY;
+
+			__file.watched[line] = false;
+			return 0;
+		}
+#endif
+
+		case GPIO_GET_LINEHANDLE_IOCTL: {
+			auto *req = static_cast<gpiohandle_request *>(__arg);
+			if (req->lines > 64)
+				return EINVAL;
+
+			LineConf confs[64];
+			uint64_t values = 0;
+
+			for (uint32_t i=0; i<req->lines; i++) {
+				confs[i].flags = req->flags;
+				if (req->default_values[i])
+					values |= 1ULL << i;
+			}
+
+			if ((req->flags & GPIOHANDLE_REQUEST_INPUT) && (req->flags & GPIOHANDLE_REQUEST_OUTPUT))
+				return EINVAL;
+
+			return request(__file, req->lineoffsets, req->lines, confs, values, req->consumer_label, false, false, false, req->fd);
+		}
+
+		case GPIO_GET_LINEEVENT_IOCTL: {
+			auto *req = static_cast<gpioevent_request *>(__arg);
+
+			LineConf conf;
+			conf.flags = req->handleflags | GPIOHANDLE_REQUEST_INPUT;
+			conf.rising = req->eventflags & GPIOEVENT_REQUEST_RISING_EDGE;
+			conf.falling = req->eventflags & GPIOEVENT_REQUEST_FALLING_EDGE;
+
+			if (conf.flags & GPIOHANDLE_REQUEST_OUTPUT)
+				return EINVAL;
+
+			return request(__file, &req->lineoffset, 1, &conf, 0, req->consumer_label, false, true, false, req->fd);
+		}
+
+#ifdef GPIOPP_ABI_V2
+		case GPIO_V2_GET_LINEINFO_IOCTL:
+		case GPIO_V2_GET_LINEINFO_WATCH_IOCTL: {
+			if (!v2_)
+				return EINVAL;
+
+			auto *li = static_cast<gpio_v2_line_info *>(__arg);
+			if (li->offset >= c.lines.size())
+				return EINVAL;
+
+			if (__request == GPIO_V2_GET_LINEINFO_WATCH_IOCTL) {
+				if (int err = watch(__file, li->offset, 2))
+					return err;
+			}
+
+			line_info_v2(c, li->offset, *li);
+			return 0;
+		}
+
+		case GPIO_V2_GET_LINE_IOCTL: {
+			if (!v2_)
+				return EINVAL;
+
+			auto *req = static_cast<gpio_v2_line_request *>(__arg);
+			if (req->num_lines > GPIO_V2_LINES_MAX)
+				return EINVAL;
+
+			LineConf confs[GPIO_V2_LINES_MAX];
+			uint64_t values;
+			bool realtime;
+
+			if (int err = parse_config(req->config, req->num_lines, confs, values, realtime))
+				return err;
+
+			bool event = std::any_of(confs, confs + req->num_lines, [](const LineConf& __c) {
+				return __c.rising || __c.falling;
+			});
+
+			int fd;
+			int err = request(__file, req->offsets, req->num_lines, confs, values, req->consumer, true, event, realtime, fd);
+			if (!err)
+				req->fd = fd;
+			return err;
+		}
+#endif
+	}
+
+	return EINVAL;
+}
+
+int GPIO::SimBackend::line_ioctl(File &__file, unsigned long __request, void *__arg) {
+	auto &c = chips_[__file.chip];
+	size_t n = __file.offsets.size();
+
+	auto is_output = [&](size_t __i) {
+		return (__file.confs[__i].flags & GPIOHANDLE_REQUEST_OUTPUT) != 0;
+	};
+
+	if (!__file.v2) {
+		switch (__request) {
+			case GPIOHANDLE_GET_LINE_VALUES_IOCTL: {
+				auto *data = static_cast<gpiohandle_data *>(__arg);
+				*data = {};
+				for (size_t i=0; i<n; i++)
+					data->values[i] = logical(__file, i);
+				return 0;
+			}
+
+			case GPIOHANDLE_SET_LINE_VALUES_IOCTL: {
+				if (__file.event || !is_output(0))
+					return EPERM;
+
+				auto *data = static_cast<gpiohandle_data *>(__arg);
+				uint64_t values = 0;
+				for (size_t i=0; i<n; i++) {
+					if (data->values[i])
+						values |= 1ULL << i;
+				}
+
+				configure(__file, __file.confs.data(), values);
+				return 0;
+			}
+
+#ifdef GPIOHANDLE_SET_CONFIG_IOCTL
+			case GPIOHANDLE_SET_CONFIG_IOCTL: {
+				if (__file.event)
+					return EINVAL;
+
+				auto *cfg = static_cast<gpiohandle_config *>(__arg);
+				if ((cfg->flags & GPIOHANDLE_REQUEST_INPUT) && (cfg->flags & GPIOHANDLE_REQUEST_OUTPUT))
+					return EINVAL;
+
+				std::vector<LineConf> confs(n);
+				uint64_t values = 0;
+				for (size_t i=0; i<n; i++) {
+					confs[i].flags = cfg->flags;
+					if (cfg->default_values[i])
+						values |= 1ULL << i;
+				}
+
+				configure(__file, confs.data(), values);
+				for (auto it : __file.offsets)
+					notify(c, it, GPIOLINE_CHANGED_CONFIG);
+				return 0;
+			}
+#endif
+		}
+
+		return EINVAL;
+	}
+
+#ifdef GPIOPP_ABI_V2
+	switch (__request) {
+		case GPIO_V2_LINE_GET_VALUES_IOCTL: {
+			auto *data = static_cast<gpio_v2_line_values *>(__arg);
+			uint64_t bits = 0;
+
+			for (size_t i=0; i<n; i++) {
+				if ((data->mask & (1ULL << i)) && logical(__file, i))
+					bits |= 1ULL << i;
+			}
+
+			data->bits = bits;
+			return 0;
+		}
+
+		case GPIO_V2_LINE_SET_VALUES_IOCTL: {
+			auto *data = static_cast<gpio_v2_line_values *>(__arg);
+
+			for (size_t i=0; i<n; i++) {
+				if ((data->mask & (1ULL << i)) && !is_output(i))
+					return EPERM;
+			}
+
+			for (size_t i=0; i<n; i++) {
+				if (!(data->mask & (1ULL << i)))
+					continue;
+
+				uint8_t v = (data->bits >> i) & 1;
+				c.lines[__file.offsets[i]].output = (__file.confs[i].flags & GPIOHANDLE_REQUEST_ACTIVE_LOW) ? !v : v;
+			}
+			return 0;
+		}
+
+		case GPIO_V2_LINE_SET_CONFIG_IOCTL: {
+			auto *cfg = static_cast<gpio_v2_line_config *>(__arg);
+
+			std::vector<LineConf> confs(n);
+			uint64_t values;
+			bool realtime;
+
+			if (int err = parse_config(*cfg, n, confs.data(), values, realtime))
+				return err;
+
+			configure(__file, confs.data(), values);
+			__file.realtime = realtime;
+			__file.event = std::any_of(confs.begin(), confs.end(), [](const LineConf& __c) {
+				return __c.rising || __c.falling;
+			});
+
+			for (auto it : __file.offsets)
+				notify(c, it, GPIOLINE_CHANGED_CONFIG);
+			return 0;
+		}
+	}
+#endif
+
+	return EINVAL;
+}
+
+int GPIO::SimBackend::open(const char *__path, int __flags) {
+	std::unique_lock<std::mutex> lk(lock_);
+
+	auto chip = std::find_if(chips_.begin(), chips_.end(), [&](const Chip& __c) {
+		return __c.path == __path;
+	});
+
+	if (chip == chips_.end()) {
+		lk.unlock();
+		return ::open(__path, __flags);
+	}
+
+	// Sequenced packets, so a read never splits a line info record
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv))
+		return -1;
+
+	set_nonblock(sv[1]);
+
+	auto f = std::make_shared<File>();
+	f->is_chip = true;
+	f->chip = chip - chips_.begin();
+	f->wfd = sv[1];
+	f->watched.resize(chip->lines.size());
+
+	chip->files.push_back(f.get());
+	files_[sv[0]] = f;
+
+	return sv[0];
+}
+
+int GPIO::SimBackend::ioctl(int __fd, unsigned long __request, void *__arg) {
+	std::unique_lock<std::mutex> lk(lock_);
+
+	auto it = files_.find(__fd);
+	if (it == files_.end()) {
+		lk.unlock();
+		return ::ioctl(__fd, __request, __arg);
+	}
+
+	auto &f = *it->second;
+	int err = f.is_chip ? chip_ioctl(f, __request, __arg) : line_ioctl(f, __request, __arg);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int GPIO::SimBackend::dup(int __fd) {
+	std::lock_guard<std::mutex> lg(lock_);
+
+	int nfd = ::dup(__fd);
+
+	auto it = files_.find(__fd);
+	if (nfd != -1 && it != files_.end())
+		files_[nfd] = it->second;
+
+	return nfd;
+}
+
+int GPIO::SimBackend::close(int __fd) {
+	std::shared_ptr<File> f;
+
+	{
+		std::lock_guard<std::mutex> lg(lock_);
+
+		auto it = files_.find(__fd);
+		if (it != files_.end()) {
+			f = std::move(it->second);
+			files_.erase(it);
+
+			// Last fd of the file gone, like the kernel's release()
+			if (f.use_count() == 1)
+				release(*f);
+		}
+	}
+
+	return ::close(__fd);
+}
+
+std::vector<std::string> GPIO::SimBackend::chip_paths() {
+	std::lock_guard<std::mutex> lg(lock_);
+
+	std::vector<std::string> ret;
+	for (auto &it : chips_)
+		ret.emplace_back(it.path);
+
+	return ret;
+}
@@ -0,0 +1,123 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	/*
+	 * GPIO chips simulated in userspace, for tests and benchmarks on machines
+	 * without GPIO hardware. Install with set_chip_backend(), then open the
+	 * chips by path() like any other.
+	 *
+	 * Both character device ABIs are spoken. Line handles are pipes that
+	 * edge events are written into, chip fds are sockets that carry line
+	 * info changes, so event listeners (epoll or io_uring) work unchanged.
+	 *
+	 * Outputs take what their handle writes, inputs what set_input() drives.
+	 * Bias flags are kept and reported, but don't pull undriven lines.
+	 * Debounce periods and event buffer sizes are accepted and ignored.
+	 */
+	class SimBackend : public ChipBackend {
+	private:
+		struct File;
+
+		struct SimLine {
+			std::string name;
+			uint8_t input = 0;
+			uint8_t output = 0;
+			// Request holding the line, and its index there
+			File *owner = nullptr;
+			uint32_t index = 0;
+		};
+
+		struct Chip {
+			std::string path, name, label;
+			std::vector<SimLine> lines;
+			// Chip fds, for line info watches
+			std::vector<File *> files;
+		};
+
+		struct LineConf {
+			// GPIOHANDLE_REQUEST_* bits
+			uint32_t flags = 0;
+			bool rising = false, falling = false;
+		};
+
+		mutable std::mutex lock_;
+		bool v2_;
+		std::vector<Chip> chips_;
+		std::unordered_map<int, std::shared_ptr<File>> files_;
+		uint64_t dropped_ = 0;
+
+		int chip_ioctl(File& __file, unsigned long __request, void *__arg);
+		int line_ioctl(File& __file, unsigned long __request, void *__arg);
+
+		int request(File& __chip_file, const uint32_t *__offsets, size_t __count, const LineConf *__confs, uint64_t __values,
+			    const char *__consumer, bool __v2, bool __event, bool __realtime, int& __fd);
+		void configure(File& __file, const LineConf *__confs, uint64_t __values);
+		void release(File& __file);
+
+		uint8_t physical(const Chip& __chip, uint32_t __line) const;
+		uint8_t logical(const File& __file, uint32_t __idx) const;
+
+		void line_info_v1(const Chip& __chip, uint32_t __line, gpioline_info& __info) const;
+#ifdef GPIOPP_ABI_V2
+		void line_info_v2(const Chip& __chip, uint32_t __line, gpio_v2_line_info& __info) const;
+		static int parse_config(const gpio_v2_line_config& __config, size_t __count, LineConf *__confs, uint64_t& __values, bool& __realtime);
+#endif
+		int watch(File& __file, uint32_t __line, int __abi);
+		void notify(const Chip& __chip, uint32_t __line, uint32_t __type);
+		void queue(int __fd, const void *__rec, size_t __len);
+
+	public:
+		// With __v2 false only ABI v1 is offered, to exercise that path on new kernels
+		explicit SimBackend(bool __v2 = true) : v2_(__v2) {}
+		~SimBackend() override;
+
+		SimBackend(const SimBackend&) = delete;
+		SimBackend& operator=(const SimBackend&) = delete;
+
+		// Returns the chip's index. Lines are unnamed unless __line_names says otherwise.
+		uint32_t add_chip(const std::string& __label, uint32_t __num_lines, const std::vector<std::string>& __line_names = {});
+
+		std::string path(uint32_t __chip) const;
+
+		// Sets the level an input sees; a change queues edge events to the line's request
+		void set_input(uint32_t __chip, uint32_t __line, uint8_t __value);
+
+		// Physical level of a line, whatever drives it
+		uint8_t level(uint32_t __chip, uint32_t __line) const;
+
+		// Events and line info changes lost to full queues
+		uint64_t dropped_events() const;
+
+		int open(const char *__path, int __flags) override;
+		int ioctl(int __fd, unsigned long __request, void *__arg) override;
+		int dup(int __fd) override;
+		int close(int __fd) override;
+		std::vector<std::string> chip_paths() override;
+	};
+}
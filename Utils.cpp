@@ -18,8 +18,62 @@
 
 #include "Utils.hpp"
 
+#include <stdexcept>
+#include <system_error>
+
+#include <cerrno>
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
 using namespace YukiWorkshop::GPIO;
 
 std::string Utils::make_device_path(uint32_t __num) {
 	return std::string("/dev/gpiochip") + std::to_string(__num);
 }
+
+uint64_t Utils::monotonic_ns() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Not __cpu: glibc's CPU_SET() declares a local of that name, which would shadow it
+void Utils::set_thread_affinity(int cpu) {
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		throw std::out_of_range("CPU number out of range");
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc)
+		throw std::system_error(rc, std::system_category(), "failed to set thread affinity");
+}
+
+void Utils::set_thread_realtime(int __priority) {
+	sched_param sp{};
+	sp.sched_priority = __priority;
+
+	int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+	if (rc)
+		throw std::system_error(rc, std::system_category(), "failed to set realtime scheduling");
+}
+
+void Utils::sleep_until_ns(uint64_t __deadline_ns, uint64_t __spin_ns) {
+	if (__deadline_ns > __spin_ns) {
+		uint64_t wake = __deadline_ns - __spin_ns;
+
+		if (monotonic_ns() < wake) {
+			timespec ts;
+			ts.tv_sec = wake / 1000000000ULL;
+			ts.tv_nsec = wake % 1000000000ULL;
+
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+		}
+	}
+
+	while (monotonic_ns() < __deadline_ns);
+}
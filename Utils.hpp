@@ -20,6 +20,7 @@
 
 #include <string>
 #include <cinttypes>
+#include <cmath>
 
 #define ExceptionWithErrno(msg)		std::system_error(errno, std::system_category(), msg)
 
@@ -27,5 +28,49 @@ namespace YukiWorkshop::GPIO {
 	class Utils {
 	public:
 		static std::string make_device_path(uint32_t __num);
+
+		// CLOCK_MONOTONIC in ns, the clock kernel event timestamps use by default
+		static uint64_t monotonic_ns();
+
+		// Pins the calling thread to one CPU, std::out_of_range outside [0, CPU_SETSIZE)
+		static void set_thread_affinity(int cpu);
+
+		// Moves the calling thread to SCHED_FIFO at __priority (1-99)
+		static void set_thread_realtime(int __priority);
+
+		// Sleeps until the CLOCK_MONOTONIC time __deadline_ns. The last __spin_ns are
+		// busy-waited, since the timer wakeup alone has tens of microseconds of slack.
+		static void sleep_until_ns(uint64_t __deadline_ns, uint64_t __spin_ns = 0);
+	};
+
+	// Running min/max/mean/stddev of a series of durations, e.g. how late a timed write was
+	struct TimingStats {
+		uint64_t count = 0;
+		int64_t min_ns = 0, max_ns = 0;
+		double sum_ns = 0, sum_sq_ns = 0;
+
+		void add(int64_t __ns) noexcept {
+			if (!count || __ns < min_ns)
+				min_ns = __ns;
+			if (!count || __ns > max_ns)
+				max_ns = __ns;
+
+			count++;
+			sum_ns += __ns;
+			sum_sq_ns += (double)__ns * __ns;
+		}
+
+		double mean_ns() const noexcept {
+			return count ? sum_ns / count : 0;
+		}
+
+		double stddev_ns() const noexcept {
+			if (!count)
+				return 0;
+
+			double m = mean_ns();
+			double var = sum_sq_ns / count - m * m;
+			return var > 0 ? std::sqrt(var) : 0;
+		}
 	};
 }
\ No newline at end of file
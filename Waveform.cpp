@@ -0,0 +1,169 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "Waveform.hpp"
+
+#include <sys/mman.h>
+
+using namespace YukiWorkshop;
+
+// Longest single sleep, so stop() is noticed during long gaps
+static const uint64_t stop_check_ns = 10000000;
+
+GPIO::Waveform::Waveform(const LineMultiple &__lines, std::vector<WaveformStep> __steps, const WaveformOptions &__options) :
+	lines_(__lines.duplicate()), steps_(std::move(__steps)), options_(__options) {
+	if (steps_.empty())
+		throw std::logic_error("waveform has no steps");
+
+	for (size_t i=1; i<steps_.size(); i++) {
+		if (steps_[i].time_ns < steps_[i-1].time_ns)
+			throw std::logic_error("waveform steps are not in time order");
+	}
+
+	if (options_.repeat != 1 && options_.period_ns <= steps_.back().time_ns)
+		throw std::logic_error("waveform period must be past the last step");
+
+	if (options_.lock_memory) {
+		if (mlock(steps_.data(), steps_.size() * sizeof(WaveformStep)))
+			throw ExceptionWithErrno("failed to lock waveform buffer");
+
+		locked_ = true;
+	}
+}
+
+GPIO::Waveform::~Waveform() {
+	stop();
+
+	if (thread_.joinable())
+		thread_.join();
+
+	if (locked_)
+		munlock(steps_.data(), steps_.size() * sizeof(WaveformStep));
+}
+
+void GPIO::Waveform::start() {
+	if (run_ || thread_.joinable())
+		throw std::logic_error("waveform already started");
+
+	run_ = true;
+	error_ = nullptr;
+
+	thread_ = std::thread([this]{
+		try {
+			play_loop();
+		} catch (...) {
+			error_ = std::current_exception();
+		}
+
+		run_ = false;
+	});
+}
+
+void GPIO::Waveform::play() {
+	if (run_)
+		throw std::logic_error("waveform already started");
+
+	run_ = true;
+
+	try {
+		play_loop();
+	} catch (...) {
+		run_ = false;
+		throw;
+	}
+
+	run_ = false;
+}
+
+void GPIO::Waveform::stop() {
+	run_ = false;
+}
+
+void GPIO::Waveform::wait() {
+	if (thread_.joinable())
+		thread_.join();
+
+	if (error_) {
+		auto e = error_;
+		error_ = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+GPIO::TimingStats GPIO::Waveform::lateness() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return lateness_;
+}
+
+GPIO::TimingStats GPIO::Waveform::write_time() const {
+	std::lock_guard<std::mutex> lg(stats_lock_);
+	return write_time_;
+}
+
+bool GPIO::Waveform::wait_until(uint64_t __deadline_ns) {
+	while (run_.load(std::memory_order_relaxed)) {
+		uint64_t now = Utils::monotonic_ns();
+
+		if (__deadline_ns <= now + options_.spin_ns + stop_check_ns) {
+			Utils::sleep_until_ns(__deadline_ns, options_.spin_ns);
+			return true;
+		}
+
+		Utils::sleep_until_ns(now + stop_check_ns);
+	}
+
+	return false;
+}
+
+void GPIO::Waveform::play_loop() {
+	if (options_.cpu >= 0)
+		Utils::set_thread_affinity(options_.cpu);
+
+	if (options_.rt_priority > 0)
+		Utils::set_thread_realtime(options_.rt_priority);
+
+	// Masked writes are only needed when the pattern drives a subset of the lines
+	uint64_t all = lines_.num_lines() >= 64 ? UINT64_MAX : (1ULL << lines_.num_lines()) - 1;
+	bool masked = (options_.mask & all) != all;
+
+	uint64_t t0 = Utils::monotonic_ns() + options_.start_delay_ns;
+
+	for (size_t iter=0; options_.repeat == 0 || iter < options_.repeat; iter++) {
+		uint64_t base = t0 + iter * options_.period_ns;
+
+		for (auto &it : steps_) {
+			uint64_t deadline = base + it.time_ns;
+
+			if (!wait_until(deadline))
+				return;
+
+			uint64_t t = Utils::monotonic_ns();
+
+			if (masked)
+				lines_.write_masked(it.bits, options_.mask);
+			else
+				lines_.write_bits(it.bits);
+
+			uint64_t t2 = Utils::monotonic_ns();
+
+			std::lock_guard<std::mutex> lg(stats_lock_);
+			lateness_.add((int64_t)(t - deadline));
+			write_time_.add((int64_t)(t2 - t));
+		}
+	}
+}
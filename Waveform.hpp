@@ -0,0 +1,102 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
+
+#include "GPIO++.hpp"
+
+namespace YukiWorkshop::GPIO {
+	struct WaveformStep {
+		// Offset from the start of the pattern, in ns
+		uint64_t time_ns;
+		// New values of the driven lines, bit i is line i of the LineMultiple
+		uint64_t bits;
+	};
+
+	struct WaveformOptions {
+		// Times to play the pattern, 0 for until stop()
+		size_t repeat = 1;
+		// Length of one repetition, must be past the last step when repeating
+		uint64_t period_ns = 0;
+		// Lines the pattern drives, the others are left alone
+		uint64_t mask = UINT64_MAX;
+		// Time between start() and the first step
+		uint64_t start_delay_ns = 1000000;
+		// Busy-wait this long before each step instead of sleeping
+		uint64_t spin_ns = 50000;
+		// SCHED_FIFO priority of the playing thread, 0 to leave it alone
+		int rt_priority = 0;
+		// CPU to pin the playing thread to, -1 for none
+		int cpu = -1;
+		// mlock() the step buffer so playing it never page faults
+		bool lock_memory = true;
+	};
+
+	/*
+	 * Plays a precomputed list of steps on a LineMultiple at absolute
+	 * CLOCK_MONOTONIC times. Every step is one write, so all lines in it
+	 * change together.
+	 */
+	class Waveform {
+	private:
+		LineMultiple lines_;
+		std::vector<WaveformStep> steps_;
+		WaveformOptions options_;
+		bool locked_ = false;
+
+		std::thread thread_;
+		std::atomic<bool> run_{false};
+		std::exception_ptr error_;
+
+		mutable std::mutex stats_lock_;
+		TimingStats lateness_, write_time_;
+
+		bool wait_until(uint64_t __deadline_ns);
+		void play_loop();
+	public:
+		Waveform(const LineMultiple& __lines, std::vector<WaveformStep> __steps, const WaveformOptions& __options = {});
+		~Waveform();
+
+		Waveform(const Waveform&) = delete;
+		Waveform& operator=(const Waveform&) = delete;
+
+		// Plays on a new thread
+		void start();
+		// Plays on the calling thread, returns when done or stopped
+		void play();
+
+		void stop();
+		// Waits for the thread started by start(), rethrows anything it threw
+		void wait();
+
+		bool running() const noexcept {
+			return run_.load();
+		}
+
+		// How late each write started relative to its step time
+		TimingStats lateness() const;
+		// How long each write took
+		TimingStats write_time() const;
+	};
+}
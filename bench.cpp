@@ -0,0 +1,580 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Benchmarks for line I/O, event dispatch, edge latency and enumeration.
+ *
+ * Runs against the userspace SimBackend (ABI v2 and v1) by default, and
+ * against a gpio-sim chip when configfs allows creating one. Results go to
+ * stdout as JSON lines, one object per benchmark; progress goes to stderr.
+ * --filter only limits what is printed, every benchmark still runs.
+ *
+ *   GPIOPlusPlus_Bench [--backend sim,sim-v1,gpio-sim] [--iterations N] [--filter substring]
+ */
+
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <functional>
+
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "GPIO++.hpp"
+#include "SimChip.hpp"
+#include "DeviceIndex.hpp"
+
+using namespace YukiWorkshop;
+
+namespace {
+	struct Options {
+		std::vector<std::string> backends;
+		uint64_t iterations = 100000;
+		std::string filter;
+	};
+
+	// A chip under test and a way to drive its inputs from outside
+	struct Target {
+		std::string backend;
+		std::string path;
+		uint32_t num_lines;
+		std::function<void(uint32_t, uint8_t)> drive;
+		// Set when drive() returns before the edge reaches the line handle
+		bool async = false;
+	};
+
+	struct Result {
+		std::string name;
+		uint64_t ops = 0;
+		uint64_t elapsed_ns = 0;
+		// Per-op samples, only for latency benchmarks
+		GPIO::TimingStats stats;
+		std::string skipped;
+	};
+
+	void emit(const Target& __t, int __abi, const Result& __r) {
+		std::ostringstream os;
+		os << "{\"type\":\"result\",\"bench\":\"" << __r.name << "\",\"backend\":\"" << __t.backend << "\",\"abi\":" << __abi;
+
+		if (!__r.skipped.empty()) {
+			os << ",\"skipped\":\"" << __r.skipped << "\"}";
+		} else {
+			double per_op = __r.ops ? (double)__r.elapsed_ns / __r.ops : 0;
+			os << ",\"ops\":" << __r.ops << ",\"elapsed_ns\":" << __r.elapsed_ns << ",\"ns_per_op\":" << per_op
+			   << ",\"ops_per_s\":" << (__r.elapsed_ns ? __r.ops * 1e9 / __r.elapsed_ns : 0);
+
+			if (__r.stats.count)
+				os << ",\"min_ns\":" << __r.stats.min_ns << ",\"mean_ns\":" << __r.stats.mean_ns()
+				   << ",\"max_ns\":" << __r.stats.max_ns << ",\"stddev_ns\":" << __r.stats.stddev_ns();
+
+			os << "}";
+		}
+
+		std::cout << os.str() << std::endl;
+
+		if (__r.skipped.empty())
+			fprintf(stderr, "  %-24s %12.1f ns/op %14.0f ops/s\n", __r.name.c_str(),
+				__r.ops ? (double)__r.elapsed_ns / __r.ops : 0, __r.elapsed_ns ? __r.ops * 1e9 / __r.elapsed_ns : 0);
+		else
+			fprintf(stderr, "  %-24s skipped: %s\n", __r.name.c_str(), __r.skipped.c_str());
+	}
+
+	template <typename F>
+	Result time_loop(const std::string& __name, uint64_t __n, F __fn) {
+		Result r;
+		r.name = __name;
+		r.ops = __n;
+
+		uint64_t t0 = GPIO::Utils::monotonic_ns();
+		for (uint64_t i=0; i<__n; i++)
+			__fn(i);
+		r.elapsed_ns = GPIO::Utils::monotonic_ns() - t0;
+
+		return r;
+	}
+
+	struct CountingSink : GPIO::EventSink {
+		std::atomic<uint64_t> events{0};
+		GPIO::TimingStats latency;
+		bool measure = false;
+
+		void consume(const GPIO::Event *__events, size_t __count) override {
+			if (measure) {
+				uint64_t now = GPIO::Utils::monotonic_ns();
+				for (size_t i=0; i<__count; i++)
+					latency.add(now - __events[i].timestamp);
+			}
+
+			events.fetch_add(__count, std::memory_order_release);
+		}
+	};
+
+	void write_file(const std::string& __path, const std::string& __value) {
+		FILE *f = fopen(__path.c_str(), "w");
+		if (!f)
+			throw ExceptionWithErrno("failed to open " + __path);
+
+		bool ok = fputs(__value.c_str(), f) >= 0;
+		ok = fclose(f) == 0 && ok;
+		if (!ok)
+			throw ExceptionWithErrno("failed to write " + __path);
+	}
+
+	std::string read_file(const std::string& __path) {
+		char buf[256] = {};
+
+		FILE *f = fopen(__path.c_str(), "r");
+		if (!f)
+			throw ExceptionWithErrno("failed to open " + __path);
+
+		if (!fgets(buf, sizeof(buf), f))
+			buf[0] = 0;
+		fclose(f);
+
+		std::string ret(buf);
+		while (!ret.empty() && ret.back() == '\n')
+			ret.pop_back();
+		return ret;
+	}
+
+	/*
+	 * A kernel gpio-sim chip set up through configfs. Inputs are driven by
+	 * the simulated pull, so edges travel the real interrupt path.
+	 */
+	class GpioSimChip {
+	private:
+		std::string dev_dir_, bank_dir_, sysfs_dir_, chip_path_;
+		uint32_t num_lines_, num_named_;
+		std::vector<int> pull_fds_;
+	public:
+		static constexpr char configfs_dir[] = "/sys/kernel/config/gpio-sim";
+
+		static bool available() {
+			return access(configfs_dir, W_OK) == 0;
+		}
+
+		GpioSimChip(uint32_t __num_lines, const std::vector<std::string>& __line_names) : num_lines_(__num_lines), num_named_(__line_names.size()) {
+			dev_dir_ = std::string(configfs_dir) + "/gpiopp-bench-" + std::to_string(getpid());
+			bank_dir_ = dev_dir_ + "/bank0";
+
+			if (mkdir(dev_dir_.c_str(), 0755) || mkdir(bank_dir_.c_str(), 0755))
+				throw ExceptionWithErrno("failed to create gpio-sim device");
+
+			write_file(bank_dir_ + "/num_lines", std::to_string(__num_lines));
+
+			for (size_t i=0; i<__line_names.size(); i++) {
+				std::string line_dir = bank_dir_ + "/line" + std::to_string(i);
+				if (mkdir(line_dir.c_str(), 0755))
+					throw ExceptionWithErrno("failed to create gpio-sim line");
+				write_file(line_dir + "/name", __line_names[i]);
+			}
+
+			write_file(dev_dir_ + "/live", "1");
+
+			std::string chip_name = read_file(bank_dir_ + "/chip_name");
+			chip_path_ = "/dev/" + chip_name;
+			sysfs_dir_ = "/sys/devices/platform/" + read_file(dev_dir_ + "/dev_name") + "/" + chip_name;
+			pull_fds_.resize(__num_lines, -1);
+		}
+
+		~GpioSimChip() {
+			for (auto it : pull_fds_) {
+				if (it != -1)
+					close(it);
+			}
+
+			try {
+				write_file(dev_dir_ + "/live", "0");
+			} catch (...) {
+
+			}
+
+			for (uint32_t i=0; i<num_named_; i++)
+				rmdir((bank_dir_ + "/line" + std::to_string(i)).c_str());
+			rmdir(bank_dir_.c_str());
+			rmdir(dev_dir_.c_str());
+		}
+
+		const std::string& path() const noexcept {
+			return chip_path_;
+		}
+
+		void set_input(uint32_t __line, uint8_t __value) {
+			int &fd = pull_fds_.at(__line);
+			if (fd == -1 && (fd = open((sysfs_dir_ + "/sim_gpio" + std::to_string(__line) + "/pull").c_str(), O_WRONLY | O_CLOEXEC)) == -1)
+				throw ExceptionWithErrno("failed to open gpio-sim pull");
+
+			const char *v = __value ? "pull-up" : "pull-down";
+			if (pwrite(fd, v, strlen(v), 0) == -1)
+				throw ExceptionWithErrno("failed to set gpio-sim pull");
+		}
+	};
+
+	// Waits for __count events in total, false on timeout
+	bool wait_events(CountingSink& __sink, uint64_t __count, GPIO::Device *__dispatch = nullptr) {
+		uint64_t deadline = GPIO::Utils::monotonic_ns() + 1000000000ULL;
+
+		while (__sink.events.load(std::memory_order_acquire) < __count) {
+			if (__dispatch)
+				__dispatch->dispatch_ready();
+			else
+				std::this_thread::yield();
+
+			if (GPIO::Utils::monotonic_ns() > deadline)
+				return false;
+		}
+
+		return true;
+	}
+
+	void bench_line_io(const Target& __t, GPIO::Device& __d, const Options& __o, const std::function<void(Result)>& __emit) {
+		uint64_t n = __o.iterations;
+
+		__emit(time_loop("line_request", n / 10, [&](uint64_t) {
+			auto l = __d.line(0, GPIO::LineMode::Input);
+		}));
+
+		{
+			auto l = __d.line(0, GPIO::LineMode::Input);
+			__emit(time_loop("read_single", n, [&](uint64_t) {
+				l.read();
+			}));
+		}
+
+		{
+			auto l = __d.line(1, GPIO::LineMode::Output);
+			__emit(time_loop("write_single", n, [&](uint64_t i) {
+				l.write(i & 1);
+			}));
+		}
+
+		{
+			auto l = __d.line(2, GPIO::LineMode::Output);
+			__emit(time_loop("set_mode_in_place", n / 10, [&](uint64_t i) {
+				l.set_mode(i & 1 ? GPIO::LineMode::Output : GPIO::LineMode::Input);
+			}));
+		}
+
+		std::vector<GPIO::LineSpec> specs;
+		for (uint32_t i=8; i<16; i++)
+			specs.push_back({i, 0});
+
+		{
+			auto bus = __d.line(specs, GPIO::LineMode::Output);
+
+			__emit(time_loop("read_bits_8", n, [&](uint64_t) {
+				bus.read_bits();
+			}));
+
+			__emit(time_loop("write_bits_8", n, [&](uint64_t i) {
+				bus.write_bits(i & 0xff);
+			}));
+
+			__emit(time_loop("write_masked_8", n, [&](uint64_t i) {
+				bus.write_masked(i, 0x0f);
+			}));
+		}
+
+		specs.clear();
+		for (uint32_t i=0; i<__t.num_lines; i++)
+			specs.push_back({i, 0});
+
+		{
+			auto group = __d.line_group(specs, GPIO::LineMode::Input);
+			std::vector<uint64_t> words(group.num_words());
+
+			__emit(time_loop("group_read_bits_" + std::to_string(__t.num_lines), n, [&](uint64_t) {
+				group.read_bits(words.data());
+			}));
+		}
+	}
+
+	void bench_dispatch(const Target& __t, GPIO::Device& __d, const Options& __o, const std::function<void(Result)>& __emit) {
+		Result r;
+		r.name = "dispatch";
+
+		std::vector<uint32_t> lines;
+		for (uint32_t i=16; i<48 && i<__t.num_lines; i++)
+			lines.push_back(i);
+
+		if (__d.abi_version() == 1 && lines.size() > 8)
+			lines.resize(8);
+
+		CountingSink sink;
+		int handle = __d.add_event(lines, GPIO::LineMode::Input, GPIO::EventMode::Both, sink);
+
+		// Bursts stay well inside the kernel's default event buffers
+		const uint64_t burst = lines.size() * 8;
+		uint64_t rounds = std::max<uint64_t>(1, __o.iterations / burst / 4), expected = 0;
+		std::vector<uint8_t> levels(__t.num_lines);
+
+		for (uint64_t round=0; round<rounds; round++) {
+			for (uint64_t i=0; i<burst; i++) {
+				uint32_t line = lines[i % lines.size()];
+				levels[line] ^= 1;
+				__t.drive(line, levels[line]);
+			}
+
+			expected += burst;
+
+			if (__t.async)
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+			uint64_t t0 = GPIO::Utils::monotonic_ns();
+			if (!wait_events(sink, expected, &__d)) {
+				r.skipped = "events went missing";
+				break;
+			}
+			r.elapsed_ns += GPIO::Utils::monotonic_ns() - t0;
+		}
+
+		r.ops = sink.events;
+		__d.remove_event(handle);
+		__emit(r);
+	}
+
+	void bench_latency(const Target& __t, GPIO::Device& __d, const Options& __o, GPIO::ListenerBackend __backend,
+			   const std::string& __name, const std::function<void(Result)>& __emit) {
+		Result r;
+		r.name = __name;
+
+		CountingSink sink;
+		sink.measure = true;
+
+		uint32_t line = std::min<uint32_t>(48, __t.num_lines - 1);
+		int handle = __d.add_event(line, GPIO::LineMode::Input, GPIO::EventMode::Both, sink);
+
+		GPIO::ListenerOptions lo;
+		lo.backend = __backend;
+
+		std::exception_ptr error;
+		std::atomic<bool> done{false};
+
+		std::thread listener([&]() {
+			try {
+				__d.run_eventlistener(lo);
+			} catch (...) {
+				error = std::current_exception();
+			}
+			done = true;
+		});
+
+		uint64_t n = std::max<uint64_t>(1, __o.iterations / 50);
+		uint8_t level = 0;
+
+		for (uint64_t i=0; i<n && !done; i++) {
+			level ^= 1;
+			__t.drive(line, level);
+
+			if (!wait_events(sink, i + 1)) {
+				r.skipped = "events went missing";
+				break;
+			}
+		}
+
+		// Also covers a listener that is still starting up
+		while (!done) {
+			__d.stop_eventlistener();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		listener.join();
+
+		__d.remove_event(handle);
+
+		if (error) {
+			try {
+				std::rethrow_exception(error);
+			} catch (std::exception& e) {
+				r.skipped = e.what();
+			}
+		}
+
+		r.ops = sink.latency.count;
+		r.elapsed_ns = sink.latency.sum_ns;
+		r.stats = sink.latency;
+		__emit(r);
+	}
+
+	void bench_enumeration(const Target& __t, GPIO::Device& __d, const Options& __o, const std::function<void(Result)>& __emit) {
+		uint64_t n = __o.iterations;
+
+		__emit(time_loop("device_open_names", std::max<uint64_t>(1, n / 100), [&](uint64_t) {
+			GPIO::Device d(__t.path);
+			d.lines_by_name();
+		}));
+
+		__emit(time_loop("index_rebuild", std::max<uint64_t>(1, n / 100), [&](uint64_t) {
+			GPIO::DeviceIndex::instance().invalidate();
+			GPIO::DeviceIndex::instance().snapshot();
+		}));
+
+		__emit(time_loop("find_line_by_name", n / 10, [&](uint64_t) {
+			GPIO::find_line_by_name("bench0");
+		}));
+
+		__emit(time_loop("line_info_ioctl", n, [&](uint64_t i) {
+			__d.line_info(i % __t.num_lines);
+		}));
+
+		GPIO::Device watched(__t.path);
+		try {
+			watched.watch_line_info();
+		} catch (std::exception& e) {
+			Result r;
+			r.name = "line_info_cached";
+			r.skipped = e.what();
+			__emit(r);
+			return;
+		}
+
+		__emit(time_loop("line_info_cached", n, [&](uint64_t i) {
+			watched.line_info(i % __t.num_lines);
+		}));
+	}
+
+	void run_target(const Target& __t, const Options& __o) {
+		GPIO::Device d(__t.path);
+		int abi = d.abi_version();
+
+		fprintf(stderr, "%s: %s, %u lines, ABI v%d\n", __t.backend.c_str(), __t.path.c_str(), __t.num_lines, abi);
+
+		auto emit_filtered = [&](const Result& __r) {
+			if (__o.filter.empty() || __r.name.find(__o.filter) != std::string::npos)
+				emit(__t, abi, __r);
+		};
+
+		bench_line_io(__t, d, __o, emit_filtered);
+		bench_dispatch(__t, d, __o, emit_filtered);
+		bench_latency(__t, d, __o, GPIO::ListenerBackend::Epoll, "latency_epoll", emit_filtered);
+		bench_latency(__t, d, __o, GPIO::ListenerBackend::IoUring, "latency_io_uring", emit_filtered);
+		bench_enumeration(__t, d, __o, emit_filtered);
+	}
+
+	std::vector<std::string> line_names(uint32_t __count) {
+		std::vector<std::string> ret;
+		for (uint32_t i=0; i<__count; i++)
+			ret.emplace_back("bench" + std::to_string(i));
+		return ret;
+	}
+
+	void run_sim(const std::string& __name, bool __v2, const Options& __o) {
+		GPIO::SimBackend sim(__v2);
+		uint32_t chip = sim.add_chip("gpiopp-bench", 128, line_names(4));
+
+		GPIO::set_chip_backend(&sim);
+
+		try {
+			run_target({__name, sim.path(chip), 128, [&](uint32_t __line, uint8_t __value) {
+				sim.set_input(chip, __line, __value);
+			}}, __o);
+		} catch (...) {
+			GPIO::set_chip_backend(nullptr);
+			throw;
+		}
+
+		GPIO::set_chip_backend(nullptr);
+
+		if (sim.dropped_events())
+			fprintf(stderr, "%s: %lu events dropped\n", __name.c_str(), (unsigned long)sim.dropped_events());
+	}
+
+	void run_gpio_sim(const Options& __o) {
+		if (!GpioSimChip::available()) {
+			fprintf(stderr, "gpio-sim: %s not writable, skipped\n", GpioSimChip::configfs_dir);
+			return;
+		}
+
+		GpioSimChip chip(64, line_names(4));
+
+		Target t{"gpio-sim", chip.path(), 64, [&](uint32_t __line, uint8_t __value) {
+			chip.set_input(__line, __value);
+		}, true};
+
+		run_target(t, __o);
+	}
+
+	Options parse_args(int argc, char **argv) {
+		Options ret;
+
+		for (int i=1; i<argc; i++) {
+			std::string arg = argv[i];
+			std::string value = i + 1 < argc ? argv[i+1] : "";
+
+			if (arg == "--backend") {
+				std::stringstream ss(value);
+				std::string it;
+				while (std::getline(ss, it, ','))
+					ret.backends.push_back(it);
+				i++;
+			} else if (arg == "--iterations") {
+				ret.iterations = std::max(100UL, strtoul(value.c_str(), nullptr, 10));
+				i++;
+			} else if (arg == "--filter") {
+				ret.filter = value;
+				i++;
+			} else {
+				throw std::invalid_argument("usage: " + std::string(argv[0]) +
+							    " [--backend sim,sim-v1,gpio-sim] [--iterations N] [--filter substring]");
+			}
+		}
+
+		if (ret.backends.empty())
+			ret.backends = {"sim", "sim-v1", "gpio-sim"};
+
+		return ret;
+	}
+}
+
+int main(int argc, char **argv) {
+	Options opts;
+
+	try {
+		opts = parse_args(argc, argv);
+	} catch (std::exception& e) {
+		std::cerr << e.what() << "\n";
+		return 2;
+	}
+
+	utsname un{};
+	uname(&un);
+
+	std::cout << "{\"type\":\"meta\",\"schema\":1,\"kernel\":\"" << un.release << "\",\"machine\":\"" << un.machine
+		  << "\",\"cpus\":" << std::thread::hardware_concurrency() << ",\"iterations\":" << opts.iterations << "}" << std::endl;
+
+	int rc = 0;
+
+	for (auto &it : opts.backends) {
+		try {
+			if (it == "sim")
+				run_sim(it, true, opts);
+			else if (it == "sim-v1")
+				run_sim(it, false, opts);
+			else if (it == "gpio-sim")
+				run_gpio_sim(opts);
+			else
+				throw std::invalid_argument("unknown backend " + it);
+		} catch (std::exception& e) {
+			std::cerr << it << ": " << e.what() << "\n";
+			rc = 1;
+		}
+	}
+
+	return rc;
+}
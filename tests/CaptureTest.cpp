@@ -0,0 +1,179 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Capture files: write, read back, VCD export, wraparound
+
+#include <sstream>
+
+#include <cstddef>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "TestUtils.hpp"
+#include "../Capture.hpp"
+
+using namespace YukiWorkshop;
+
+static std::string temp_path() {
+	char path[] = "/tmp/gpiopp-capture-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd != -1)
+		close(fd);
+	return path;
+}
+
+static GPIO::Event edge(uint32_t __line, bool __rising, uint64_t __ts) {
+	return {__rising ? GPIO::EventType::RisingEdge : GPIO::EventType::FallingEdge, __ts, __line, 0, 0};
+}
+
+static void round_trip() {
+	auto path = temp_path();
+	const uint64_t t0 = 5000000000ULL;
+
+	// Small deltas, one needing a time escape (> 2^24 ns), and a line not captured
+	std::vector<GPIO::Event> in = {
+		edge(3, true, t0), edge(4, true, t0 + 10), edge(3, false, t0 + 1000),
+		edge(4, false, t0 + 100000000ULL), edge(9, true, t0 + 100000001ULL), edge(5, true, t0 + 100000002ULL)
+	};
+
+	{
+		GPIO::CaptureWriter w(path, {3, 4, 5}, 16 * 4096);
+		w.consume(in.data(), 3);
+		w.consume(in.data() + 3, in.size() - 3);
+
+		CHECK_EQ(w.edges(), 5u);
+		CHECK_EQ(w.ignored(), 1u);
+		CHECK_EQ(w.reordered(), 0u);
+	}
+
+	GPIO::CaptureReader r(path);
+	CHECK(r.lines() == std::vector<uint32_t>({3, 4, 5}));
+
+	std::vector<GPIO::Event> out;
+	r.for_each([&](const GPIO::Event& __ev) {
+		out.push_back(__ev);
+	});
+
+	in.erase(in.begin() + 4);
+	CHECK_EQ(out.size(), in.size());
+	for (size_t i=0; i<std::min(out.size(), in.size()); i++) {
+		CHECK_EQ(out[i].line, in[i].line);
+		CHECK(out[i].type == in[i].type);
+		CHECK_EQ(out[i].timestamp, in[i].timestamp);
+	}
+
+	std::ostringstream vcd;
+	r.export_vcd(vcd);
+	auto text = vcd.str();
+
+	CHECK(text.find("$var wire 1 ! line3 $end") != std::string::npos);
+	CHECK(text.find("$var wire 1 # line5 $end") != std::string::npos);
+	CHECK(text.find("$end\n1!\n#10\n1\"\n#1000\n0!\n#100000000\n0\"\n#100000002\n1#\n") != std::string::npos);
+
+	unlink(path.c_str());
+}
+
+// Once the ring is full the oldest blocks go, what is left is still in order
+static void wraparound() {
+	auto path = temp_path();
+	const size_t total = 20000;
+
+	{
+		// 4 blocks of ~1000 records
+		GPIO::CaptureWriter w(path, {1}, 5 * 4096);
+		for (size_t i=0; i<total; i++) {
+			auto ev = edge(1, i & 1, 1000 + i * 100);
+			w.consume(&ev, 1);
+		}
+		CHECK_EQ(w.edges(), total);
+	}
+
+	GPIO::CaptureReader r(path);
+	size_t n = 0;
+	uint64_t last = 0;
+	bool ordered = true, levels = true;
+
+	r.for_each([&](const GPIO::Event& __ev) {
+		ordered &= __ev.timestamp > last;
+		// Recorded level i & 1 at 1000 + i * 100
+		levels &= (__ev.type == GPIO::EventType::RisingEdge) == (((__ev.timestamp - 1000) / 100) & 1);
+		last = __ev.timestamp;
+		n++;
+	});
+
+	CHECK(n > 0 && n < total);
+	CHECK(ordered);
+	CHECK(levels);
+	CHECK_EQ(last, 1000 + (total - 1) * 100);
+
+	unlink(path.c_str());
+}
+
+static bool rejected(const std::string& __path) {
+	try {
+		GPIO::CaptureReader r(__path);
+	} catch (std::runtime_error&) {
+		return true;
+	}
+	return false;
+}
+
+template <typename T>
+static void patch(const std::string& __path, size_t __offset, T __value) {
+	int fd = open(__path.c_str(), O_WRONLY);
+	CHECK(fd != -1 && pwrite(fd, &__value, sizeof(__value), __offset) == sizeof(__value));
+	close(fd);
+}
+
+// Corrupt headers must not crash the reader or send it outside the file
+static void bad_headers() {
+	auto path = temp_path();
+
+	auto fresh = [&] {
+		GPIO::CaptureWriter w(path, {1}, 8 * 4096);
+	};
+
+	fresh();
+	CHECK(!rejected(path));
+
+	patch<uint64_t>(path, offsetof(GPIO::CaptureFileHeader, num_blocks), 0);
+	CHECK(rejected(path));
+
+	fresh();
+	patch<uint64_t>(path, offsetof(GPIO::CaptureFileHeader, num_blocks), (1ULL << 52) + 1);
+	CHECK(rejected(path));
+
+	fresh();
+	patch<uint32_t>(path, offsetof(GPIO::CaptureFileHeader, block_size), 100);
+	CHECK(rejected(path));
+
+	fresh();
+	CHECK(truncate(path.c_str(), 3 * 4096) == 0);
+	CHECK(rejected(path));
+
+	unlink(path.c_str());
+}
+
+int main() {
+	round_trip();
+	wraparound();
+	bad_headers();
+
+	return GPIOTest::result("CaptureTest");
+}
@@ -0,0 +1,179 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Pulse counter and quadrature decoder
+
+#include "TestUtils.hpp"
+#include "../Counter.hpp"
+
+using namespace YukiWorkshop;
+
+static GPIO::Event edge(uint32_t __line, bool __rising, uint64_t __ts) {
+	GPIO::Event ev{};
+	ev.type = __rising ? GPIO::EventType::RisingEdge : GPIO::EventType::FallingEdge;
+	ev.line = __line;
+	ev.timestamp = __ts;
+	return ev;
+}
+
+// A and B on lines 0 and 1. Forward, A leads B: 00 -> 10 -> 11 -> 01 -> 00.
+static const GPIO::Event forward_cycle[4] = {
+	edge(0, true, 0), edge(1, true, 0), edge(0, false, 0), edge(1, false, 0)
+};
+
+// Feeds __count edges of the cycle one event per consume(), 1us apart from __ts
+static void feed(GPIO::EventSink& __sink, const GPIO::Event *__edges, size_t __count, uint64_t& __ts) {
+	for (size_t i=0; i<__count; i++) {
+		auto ev = __edges[i];
+		ev.timestamp = __ts += 1000;
+		__sink.consume(&ev, 1);
+	}
+}
+
+static void quadrature_directions() {
+	GPIO::QuadratureEncoder enc(0, 1, 0, 0);
+	uint64_t ts = 0;
+
+	feed(enc, forward_cycle, 4, ts);
+	feed(enc, forward_cycle, 4, ts);
+	CHECK_EQ(enc.position(), 8);
+	CHECK_EQ(enc.illegal_transitions(), 0);
+	CHECK_EQ(enc.velocity(), 1e6);
+
+	// The same edges backwards: 00 -> 01 -> 11 -> 10 -> 00
+	const GPIO::Event reverse_cycle[4] = {
+		edge(1, true, 0), edge(0, true, 0), edge(1, false, 0), edge(0, false, 0)
+	};
+	feed(enc, reverse_cycle, 4, ts);
+	CHECK_EQ(enc.position(), 4);
+	CHECK_EQ(enc.velocity(), -1e6);
+	// Stopped for longer than the last interval
+	CHECK_EQ(enc.velocity(ts + 4000), -0.25e6);
+
+	enc.set_position(-10);
+	feed(enc, forward_cycle, 2, ts);
+	CHECK_EQ(enc.position(), -8);
+	CHECK_EQ(enc.illegal_transitions(), 0);
+}
+
+// A level seen twice in a row means an edge was lost
+static void quadrature_illegal() {
+	GPIO::QuadratureEncoder enc(0, 1, 0, 0);
+	uint64_t ts = 0;
+
+	feed(enc, forward_cycle, 1, ts);
+	feed(enc, forward_cycle, 1, ts);
+	CHECK_EQ(enc.position(), 1);
+	CHECK_EQ(enc.illegal_transitions(), 1);
+
+	// Counting resumes from the repeated level, whole batches work the same
+	GPIO::Event rest[3] = {forward_cycle[1], forward_cycle[2], forward_cycle[3]};
+	for (auto &it : rest)
+		it.timestamp = ts += 1000;
+	enc.consume(rest, 3);
+	CHECK_EQ(enc.position(), 4);
+	CHECK_EQ(enc.illegal_transitions(), 1);
+
+	// Other lines are not ours
+	auto other = edge(7, true, ts += 1000);
+	enc.consume(&other, 1);
+	CHECK_EQ(enc.position(), 4);
+	CHECK_EQ(enc.illegal_transitions(), 1);
+}
+
+// Without initial levels the first edge of each line only sets its level
+static void quadrature_unknown_levels() {
+	GPIO::QuadratureEncoder enc(0, 1);
+	uint64_t ts = 0;
+
+	// Repeated edges on A can't be illegal yet
+	feed(enc, forward_cycle, 1, ts);
+	feed(enc, forward_cycle, 1, ts);
+	feed(enc, forward_cycle + 1, 1, ts);
+	CHECK_EQ(enc.position(), 0);
+	CHECK_EQ(enc.illegal_transitions(), 0);
+
+	// Now at 11
+	feed(enc, forward_cycle + 2, 2, ts);
+	CHECK_EQ(enc.position(), 2);
+	CHECK_EQ(enc.illegal_transitions(), 0);
+
+	bool threw = false;
+	try {
+		GPIO::QuadratureEncoder bad(3, 3);
+	} catch (std::logic_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+static void pulses() {
+	GPIO::PulseCounter cnt(2);
+
+	GPIO::Event evs[] = {
+		edge(2, true, 1000), edge(2, false, 1500), edge(3, true, 1600), edge(2, true, 2000)
+	};
+	cnt.consume(evs, 4);
+	CHECK_EQ(cnt.count(), 2);
+	CHECK_EQ(cnt.last_timestamp(), 2000);
+	CHECK_EQ(cnt.frequency(), 1e6);
+	CHECK_EQ(cnt.frequency(6000), 0.25e6);
+
+	cnt.reset();
+	CHECK_EQ(cnt.count(), 0);
+
+	GPIO::PulseCounter both(2, GPIO::EventMode::Both);
+	both.consume(evs, 4);
+	CHECK_EQ(both.count(), 3);
+}
+
+// Through a device on the simulated chip, both lines in one add_event()
+static void from_device(bool __v2) {
+	GPIOTest::SimChip sc(__v2);
+	GPIO::Device d(sc.path());
+
+	GPIO::QuadratureEncoder enc(4, 5, 0, 0);
+	d.add_event({4, 5}, GPIO::LineMode::Input, GPIO::EventMode::Both, enc);
+
+	const std::pair<uint32_t, uint8_t> cycle[] = {{4, 1}, {5, 1}, {4, 0}, {5, 0}};
+
+	// On v1 each line has its own fd, so dispatch every edge before the next
+	for (int i=0; i<3; i++) {
+		for (auto &it : cycle) {
+			sc.set_input(it.first, it.second);
+			d.dispatch_ready();
+		}
+	}
+	CHECK_EQ(enc.position(), 12);
+
+	sc.set_input(5, 1);
+	d.dispatch_ready();
+	CHECK_EQ(enc.position(), 11);
+	CHECK_EQ(enc.illegal_transitions(), 0);
+}
+
+int main() {
+	quadrature_directions();
+	quadrature_illegal();
+	quadrature_unknown_levels();
+	pulses();
+	from_device(true);
+	from_device(false);
+
+	return GPIOTest::result("CounterTest");
+}
@@ -0,0 +1,130 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// EdgeFilter: glitch rejection, debounce, pass-through and timer expiry
+
+#include "TestUtils.hpp"
+#include "../EdgeFilter.hpp"
+
+using namespace YukiWorkshop;
+
+static const uint64_t ms = 1000000, us = 1000;
+static const uint64_t t0 = 1000 * ms;
+
+static GPIO::Event edge(uint32_t __line, bool __rising, uint64_t __ts, uint32_t __seqno = 0) {
+	return {__rising ? GPIO::EventType::RisingEdge : GPIO::EventType::FallingEdge, __ts, __line, __seqno, __seqno};
+}
+
+static void glitch_rejected() {
+	GPIO::EdgeFilter f({5}, 0, 1 * ms);
+	GPIO::Event in[] = {edge(5, true, t0), edge(5, false, t0 + 10 * us)};
+	GPIO::Event out[4];
+
+	CHECK_EQ(f.filter(in, 2, out), 0u);
+	CHECK_EQ(f.next_deadline(), 0u);
+	CHECK_EQ(f.expire(t0 + 2 * ms, out), 0u);
+
+	// A lone first edge is held too, not passed through
+	GPIO::Event rise = edge(5, true, t0 + 5 * ms);
+	CHECK_EQ(f.filter(&rise, 1, out), 0u);
+	CHECK_EQ(f.next_deadline(), t0 + 6 * ms);
+}
+
+static void bounces_debounced() {
+	GPIO::EdgeFilter f({5}, 1 * ms, 0);
+	GPIO::Event in[] = {edge(5, false, t0, 1), edge(5, true, t0 + 50 * us, 2), edge(5, false, t0 + 80 * us, 3)};
+	GPIO::Event out[6];
+
+	CHECK_EQ(f.filter(in, 3, out), 0u);
+	CHECK_EQ(f.next_deadline(), t0 + 80 * us + 1 * ms);
+	CHECK_EQ(f.expire(t0 + 1 * ms, out), 0u);
+
+	CHECK_EQ(f.expire(t0 + 80 * us + 1 * ms, out), 1u);
+	CHECK(out[0].type == GPIO::EventType::FallingEdge);
+	CHECK_EQ(out[0].timestamp, t0 + 80 * us);
+	CHECK_EQ(out[0].line, 5u);
+	CHECK_EQ(out[0].seqno, 3u);
+	CHECK_EQ(f.next_deadline(), 0u);
+}
+
+static void stable_levels_pass() {
+	GPIO::EdgeFilter f({5}, 0, 1 * ms);
+	GPIO::Event out[4];
+
+	// The next edge coming in after the hold reports the previous one, without the timer
+	GPIO::Event in[] = {edge(5, true, t0), edge(5, false, t0 + 5 * ms)};
+	CHECK_EQ(f.filter(in, 2, out), 1u);
+	CHECK(out[0].type == GPIO::EventType::RisingEdge);
+	CHECK_EQ(out[0].timestamp, t0);
+
+	CHECK_EQ(f.next_deadline(), t0 + 6 * ms);
+	CHECK_EQ(f.expire(t0 + 6 * ms, out), 1u);
+	CHECK(out[0].type == GPIO::EventType::FallingEdge);
+	CHECK_EQ(out[0].timestamp, t0 + 5 * ms);
+
+	// Exactly the minimum pulse width is long enough
+	GPIO::Event pulse[] = {edge(5, true, t0 + 10 * ms), edge(5, false, t0 + 11 * ms)};
+	CHECK_EQ(f.filter(pulse, 2, out), 1u);
+	CHECK_EQ(f.expire(t0 + 12 * ms, out), 1u);
+}
+
+static void lines_independent() {
+	GPIO::EdgeFilter f({2, 7}, 1 * ms, 0);
+	GPIO::Event out[8];
+
+	GPIO::Event in[] = {edge(2, true, t0), edge(7, true, t0 + 500 * us), edge(7, false, t0 + 600 * us), edge(9, true, t0)};
+	CHECK_EQ(f.filter(in, 4, out), 0u);
+	CHECK_EQ(f.next_deadline(), t0 + 1 * ms);
+
+	CHECK_EQ(f.expire(t0 + 2 * ms, out), 1u);
+	CHECK_EQ(out[0].line, 2u);
+	CHECK_EQ(f.next_deadline(), 0u);
+}
+
+// Through Device, on the simulated chip: the first of several short presses
+// must not get through as soon as it starts
+static void device_glitches() {
+	GPIOTest::SimChip sc;
+	GPIO::Device d(sc.path());
+
+	GPIO::EventOptions opts;
+	opts.min_pulse_ns = 1000 * ms;
+	int edges = 0;
+
+	d.add_event(4, GPIO::LineMode::Input, GPIO::EventMode::Both, [&](GPIO::EventType, uint64_t) {
+		edges++;
+	}, "", opts);
+
+	for (int i=0; i<5; i++) {
+		sc.set_input(4, 1);
+		sc.set_input(4, 0);
+	}
+
+	d.dispatch_ready();
+	CHECK_EQ(edges, 0);
+}
+
+int main() {
+	glitch_rejected();
+	bounces_debounced();
+	stable_levels_pass();
+	lines_independent();
+	device_glitches();
+
+	return GPIOTest::result("EdgeFilterTest");
+}
@@ -0,0 +1,159 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// EventRing: overflow policies and their counters
+
+#include "TestUtils.hpp"
+#include "../EventRing.hpp"
+
+using namespace YukiWorkshop;
+
+// Events numbered through seqno, starting at __first
+static std::vector<GPIO::Event> events(uint32_t __first, size_t __count) {
+	std::vector<GPIO::Event> ret(__count);
+
+	for (size_t i=0; i<__count; i++) {
+		ret[i].type = GPIO::EventType::RisingEdge;
+		ret[i].timestamp = __first + i;
+		ret[i].seqno = __first + i;
+	}
+
+	return ret;
+}
+
+static void push(GPIO::EventRing& __ring, uint32_t __first, size_t __count) {
+	auto evs = events(__first, __count);
+	__ring.consume(evs.data(), evs.size());
+}
+
+// Pops everything and returns the seqnos
+static std::vector<uint32_t> drain(GPIO::EventRing& __ring) {
+	std::vector<uint32_t> ret;
+	GPIO::Event buf[4];
+	size_t n;
+
+	while ((n = __ring.pop(buf, 4)))
+		for (size_t i=0; i<n; i++)
+			ret.push_back(buf[i].seqno);
+
+	return ret;
+}
+
+static void capacity_rounded() {
+	CHECK_EQ(GPIO::EventRing(1).capacity(), 1);
+	CHECK_EQ(GPIO::EventRing(5).capacity(), 8);
+	CHECK_EQ(GPIO::EventRing(8).capacity(), 8);
+}
+
+static void drop_newest() {
+	GPIO::EventRing ring(4);
+
+	push(ring, 0, 3);
+	push(ring, 3, 3);
+	CHECK_EQ(ring.size(), 4);
+	CHECK_EQ(ring.pushed(), 4);
+	CHECK_EQ(ring.dropped(), 2);
+	CHECK_EQ(ring.overflows(), 1);
+
+	GPIO::Event buf[2];
+	CHECK_EQ(ring.pop(buf, 2), 2);
+	CHECK_EQ(buf[0].seqno, 0);
+	CHECK_EQ(buf[1].seqno, 1);
+
+	push(ring, 6, 2);
+	CHECK_EQ(ring.overflows(), 1);
+	CHECK((drain(ring) == std::vector<uint32_t>{2, 3, 6, 7}));
+	CHECK(ring.empty());
+}
+
+static void drop_oldest() {
+	GPIO::EventRing ring(5, GPIO::OverflowPolicy::DropOldest);
+
+	push(ring, 0, 6);
+	push(ring, 6, 4);
+	CHECK_EQ(ring.size(), 8);
+	CHECK_EQ(ring.pushed(), 10);
+	CHECK_EQ(ring.dropped(), 2);
+	CHECK_EQ(ring.overflows(), 1);
+	CHECK((drain(ring) == std::vector<uint32_t>{2, 3, 4, 5, 6, 7, 8, 9}));
+
+	// A batch larger than the ring keeps only its newest events
+	push(ring, 100, 3);
+	push(ring, 200, 20);
+	CHECK_EQ(ring.dropped(), 2 + 3 + 12);
+	CHECK_EQ(ring.overflows(), 2);
+
+	std::vector<uint32_t> expected;
+	for (uint32_t i=212; i<220; i++)
+		expected.push_back(i);
+	CHECK(drain(ring) == expected);
+}
+
+static void report() {
+	GPIO::EventRing ring(4, GPIO::OverflowPolicy::Report);
+
+	std::vector<uint64_t> reports;
+	ring.set_overflow_handler([&](uint64_t lost) {
+		reports.push_back(lost);
+	});
+
+	push(ring, 0, 2);
+	CHECK(reports.empty());
+
+	push(ring, 2, 4);
+	push(ring, 6, 1);
+	CHECK((reports == std::vector<uint64_t>{2, 1}));
+	CHECK_EQ(ring.dropped(), 3);
+	CHECK_EQ(ring.overflows(), 2);
+	CHECK((drain(ring) == std::vector<uint32_t>{0, 1, 2, 3}));
+}
+
+// Fed by a device on the simulated chip
+static void from_device() {
+	GPIOTest::SimChip sc;
+	GPIO::Device d(sc.path());
+
+	GPIO::EventRing ring(4);
+	d.add_event(3, GPIO::LineMode::Input, GPIO::EventMode::Both, ring);
+
+	for (int i=0; i<3; i++) {
+		sc.set_input(3, 1);
+		sc.set_input(3, 0);
+	}
+	d.dispatch_ready();
+
+	CHECK_EQ(ring.pushed(), 4);
+	CHECK_EQ(ring.dropped(), 2);
+
+	GPIO::Event buf[4];
+	CHECK_EQ(ring.pop(buf, 4), 4);
+	for (size_t i=0; i<4; i++) {
+		CHECK_EQ(buf[i].line, 3);
+		CHECK_EQ(buf[i].line_seqno, i + 1);
+	}
+}
+
+int main() {
+	capacity_rounded();
+	drop_newest();
+	drop_oldest();
+	report();
+	from_device();
+
+	return GPIOTest::result("EventRingTest");
+}
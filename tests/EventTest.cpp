@@ -0,0 +1,128 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Event delivery: batching of drained events, one request per 64 lines on ABI v2
+
+#include <set>
+
+#include "TestUtils.hpp"
+
+using namespace YukiWorkshop;
+
+// Edges queued before a dispatch reach the batch handler in one call per
+// read(), in order, at most event_batch_size at a time
+static void batch_dispatch(bool __v2) {
+	GPIOTest::SimChip sc(__v2);
+	GPIO::Device d(sc.path());
+
+	std::vector<size_t> calls;
+	std::vector<GPIO::Event> seen;
+
+	d.add_event(5, GPIO::LineMode::Input, GPIO::EventMode::Both, GPIO::BatchEventHandler([&](const GPIO::Event *evs, size_t n) {
+		calls.push_back(n);
+		seen.insert(seen.end(), evs, evs + n);
+	}));
+
+	for (int i=0; i<6; i++) {
+		sc.set_input(5, 1);
+		sc.set_input(5, 0);
+	}
+
+	CHECK_EQ(d.dispatch_ready(), 12);
+	CHECK_EQ(calls.size(), 1);
+	CHECK_EQ(seen.size(), 12);
+
+	for (size_t i=0; i<seen.size(); i++) {
+		CHECK_EQ(seen[i].line, 5);
+		CHECK(seen[i].type == (i % 2 ? GPIO::EventType::FallingEdge : GPIO::EventType::RisingEdge));
+		if (i)
+			CHECK(seen[i].timestamp >= seen[i-1].timestamp);
+		if (__v2)
+			CHECK_EQ(seen[i].line_seqno, i + 1);
+	}
+
+	// More than one read's worth
+	calls.clear();
+	seen.clear();
+
+	for (int i=0; i<50; i++) {
+		sc.set_input(5, 1);
+		sc.set_input(5, 0);
+	}
+
+	CHECK_EQ(d.dispatch_ready(), 100);
+	CHECK_EQ(calls.size(), 2);
+	if (calls.size() == 2) {
+		CHECK_EQ(calls[0], GPIO::Device::event_batch_size);
+		CHECK_EQ(calls[1], 100 - GPIO::Device::event_batch_size);
+	}
+	CHECK_EQ(seen.size(), 100);
+	if (!seen.empty())
+		CHECK(seen.back().type == GPIO::EventType::FallingEdge);
+}
+
+// 100 lines under one handle: two kernel requests on v2, one per line on v1
+static void lines_chunked(bool __v2) {
+	GPIOTest::SimChip sc(__v2);
+	GPIO::Device d(sc.path());
+
+	std::vector<uint32_t> lines;
+	for (uint32_t i=0; i<100; i++)
+		lines.push_back(i);
+
+	std::set<uint32_t> seen;
+	int handle = d.add_event(lines, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, [&](uint32_t line, GPIO::EventType, uint64_t) {
+		seen.insert(line);
+	});
+
+	CHECK_EQ(d.event_fds().size(), __v2 ? 2 : 100);
+
+	// Both sides of the chunk boundary
+	for (uint32_t it : {0, 63, 64, 99})
+		sc.set_input(it, 1);
+
+	CHECK_EQ(d.dispatch_ready(), 4);
+	CHECK((seen == std::set<uint32_t>{0, 63, 64, 99}));
+
+	// The lines are requested, so they can't be watched twice
+	bool threw = false;
+	try {
+		d.add_event(70, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, [](GPIO::EventType, uint64_t) {});
+	} catch (std::system_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+
+	// Removing the handle releases every chunk
+	d.remove_event(handle);
+	CHECK(d.event_fds().empty());
+
+	d.add_event(70, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, [](GPIO::EventType, uint64_t) {});
+	CHECK_EQ(d.event_fds().size(), 1);
+}
+
+int main() {
+	GPIOTest::watchdog(30);
+
+	for (bool v2 : {true, false}) {
+		batch_dispatch(v2);
+		lines_chunked(v2);
+	}
+
+	return GPIOTest::result("EventTest");
+}
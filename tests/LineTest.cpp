@@ -0,0 +1,139 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Line handles: reconfiguration, bit packing of line groups
+
+#include "TestUtils.hpp"
+
+using namespace YukiWorkshop;
+
+static bool is_output(GPIO::LineMode __mode) {
+	return (__mode & GPIO::LineMode::Output) == GPIO::LineMode::Output;
+}
+
+// Reconfiguring with the label a handle already has stays in place. A new
+// request would fail with EBUSY while the duplicate holds the lines.
+static void set_mode_same_label_in_place(bool __v2) {
+	GPIOTest::SimChip sc(__v2);
+	GPIO::Device d(sc.path());
+
+	auto single = d.line(1, GPIO::LineMode::Output, 1, "led");
+	auto single_dup = single.duplicate();
+	single.set_mode(GPIO::LineMode::Input, 0, "led");
+	CHECK(!is_output(d.line_info(1).mode));
+
+	auto bus = d.line({{4, 0}, {5, 1}}, GPIO::LineMode::Output, "bus");
+	auto bus_dup = bus.duplicate();
+	bus.set_mode(GPIO::LineMode::Input, 0, "bus");
+	CHECK(!is_output(d.line_info(4).mode));
+	CHECK(!is_output(d.line_info(5).mode));
+
+	bus.set_mode(GPIO::LineMode::Output, 0b01);
+	CHECK_EQ(sc.level(4), 1);
+	CHECK_EQ(sc.level(5), 0);
+
+	// A different label needs a new request
+	bool threw = false;
+	try {
+		bus.set_mode(GPIO::LineMode::Input, 0, "other");
+	} catch (std::system_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+static std::vector<GPIO::LineSpec> specs(uint32_t __first, uint32_t __count) {
+	std::vector<GPIO::LineSpec> ret;
+
+	for (uint32_t i=0; i<__count; i++)
+		ret.push_back({__first + i, 0});
+
+	return ret;
+}
+
+static bool bit(const uint64_t *__words, size_t __i) {
+	return (__words[__i / 64] >> (__i % 64)) & 1;
+}
+
+// Line i of a group is bit i % 64 of word i / 64, also for handles that
+// straddle a word: here 40 + 50 + 30 lines, the second one across lines 63/64
+static void group_bits_across_handles(bool __v2) {
+	GPIOTest::SimChip sc(__v2);
+	GPIO::Device d(sc.path());
+
+	GPIO::LineGroup group;
+	group.add(d.line(specs(0, 40), GPIO::LineMode::Output, "group"));
+	group.add(d.line(specs(40, 50), GPIO::LineMode::Output, "group"));
+	group.add(d.line(specs(90, 30), GPIO::LineMode::Output, "group"));
+	CHECK_EQ(group.num_lines(), 120);
+	CHECK_EQ(group.num_words(), 2);
+	CHECK_EQ(group.num_handles(), 3);
+
+	const uint64_t words[2] = {0xf00dfeedcafe1235, 0x00a5a5a5deadbeef};
+	group.write_bits(words);
+	for (size_t i=0; i<120; i++)
+		CHECK_EQ(sc.level(i), bit(words, i));
+
+	uint64_t back[2];
+	group.read_bits(back);
+	CHECK_EQ(back[0], words[0]);
+	CHECK_EQ(back[1], words[1] & ((1ULL << 56) - 1));
+
+	// Only lines 62..65 change, all of them in the second handle
+	const uint64_t mask[2] = {3ULL << 62, 3};
+	const uint64_t flipped[2] = {~words[0], ~words[1]};
+	group.write_masked(flipped, mask);
+	for (size_t i=0; i<120; i++)
+		CHECK_EQ(sc.level(i), bit(words, i) ^ (i >= 62 && i <= 65));
+
+	std::vector<uint8_t> values(120);
+	group.read(values.data());
+	for (size_t i=0; i<120; i++)
+		CHECK_EQ(values[i], sc.level(i));
+}
+
+// line_group() splits into handles of max_lines_per_handle lines
+static void group_inputs(bool __v2) {
+	GPIOTest::SimChip sc(__v2);
+	GPIO::Device d(sc.path());
+
+	auto group = d.line_group(specs(0, 100), GPIO::LineMode::Input, "group");
+	CHECK_EQ(group.num_handles(), 2);
+	CHECK_EQ(group.num_words(), 2);
+
+	for (uint32_t i=0; i<100; i++)
+		sc.set_input(i, i % 3 == 0 || i == 64);
+
+	uint64_t words[2];
+	group.read_bits(words);
+	for (size_t i=0; i<100; i++)
+		CHECK_EQ(bit(words, i), i % 3 == 0 || i == 64);
+	CHECK_EQ(words[1] >> 36, 0);
+}
+
+int main() {
+	set_mode_same_label_in_place(true);
+	set_mode_same_label_in_place(false);
+
+	for (bool v2 : {true, false}) {
+		group_bits_across_handles(v2);
+		group_inputs(v2);
+	}
+
+	return GPIOTest::result("LineTest");
+}
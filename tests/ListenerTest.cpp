@@ -0,0 +1,112 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Event listener: handlers calling back into the device, listener lifecycle
+
+#include <atomic>
+#include <future>
+#include <thread>
+
+#include "TestUtils.hpp"
+
+using namespace YukiWorkshop;
+
+// A handler takes event_lock (here through stop_eventlistener()) while another
+// thread removes an event and waits for running handlers to finish
+static void handler_locks_while_removing(GPIO::ListenerBackend __backend) {
+	GPIOTest::SimChip sc;
+	GPIO::Device d(sc.path());
+
+	std::atomic<bool> in_handler{false};
+
+	d.add_event(1, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, [&](GPIO::EventType, uint64_t) {
+		in_handler = true;
+		// Long enough for remove_event() below to start waiting for this handler
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		d.stop_eventlistener();
+	});
+
+	int other = d.add_event(2, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, [](GPIO::EventType, uint64_t) {});
+
+	GPIO::ListenerOptions opts;
+	opts.backend = __backend;
+	auto listener = std::async(std::launch::async, [&] {
+		d.run_eventlistener(opts);
+	});
+
+	sc.set_input(1, 1);
+	while (!in_handler)
+		std::this_thread::yield();
+
+	d.remove_event(other);
+	listener.get();
+
+	CHECK(d.event_fds().size() == 1);
+}
+
+// Same, with the handler adding and removing events itself
+static void handler_adds_and_removes(GPIO::ListenerBackend __backend) {
+	GPIOTest::SimChip sc;
+	GPIO::Device d(sc.path());
+
+	std::atomic<bool> in_handler{false};
+	std::atomic<int> added{-1};
+
+	int self = d.add_event(1, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, [&](GPIO::EventType, uint64_t) {
+		in_handler = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		added = d.add_event(3, GPIO::LineMode::Input, GPIO::EventMode::Both, [](GPIO::EventType, uint64_t) {});
+		d.remove_event(self);
+	});
+
+	int other = d.add_event(2, GPIO::LineMode::Input, GPIO::EventMode::RisingEdge, [](GPIO::EventType, uint64_t) {});
+
+	GPIO::ListenerOptions opts;
+	opts.backend = __backend;
+	opts.threads = 2;
+	auto listener = std::async(std::launch::async, [&] {
+		d.run_eventlistener(opts);
+	});
+
+	sc.set_input(1, 1);
+	while (!in_handler)
+		std::this_thread::yield();
+
+	d.remove_event(other);
+
+	while (added < 0)
+		std::this_thread::yield();
+
+	d.stop_eventlistener();
+	listener.get();
+
+	auto fds = d.event_fds();
+	CHECK(fds.size() == 1);
+	CHECK(!fds.empty() && fds[0] == added);
+}
+
+int main() {
+	GPIOTest::watchdog(30);
+
+	for (auto backend : {GPIO::ListenerBackend::Epoll, GPIO::ListenerBackend::Auto}) {
+		handler_locks_while_removing(backend);
+		handler_adds_and_removes(backend);
+	}
+
+	return GPIOTest::result("ListenerTest");
+}
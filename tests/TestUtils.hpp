@@ -0,0 +1,89 @@
+/*
+    This file is part of GPIO++.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/*
+ * Minimal helpers for the tests in this directory. They run without
+ * hardware: devices come from a SimBackend installed for the test.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "../GPIO++.hpp"
+#include "../SimChip.hpp"
+
+namespace GPIOTest {
+	inline int failures = 0;
+
+	// A simulated chip installed as the chip backend for the lifetime of this object
+	struct SimChip {
+		YukiWorkshop::GPIO::SimBackend sim;
+		uint32_t chip;
+
+		explicit SimChip(bool __v2 = true, uint32_t __num_lines = 128, const std::vector<std::string>& __names = {}) :
+			sim(__v2), chip(sim.add_chip("sim", __num_lines, __names)) {
+			YukiWorkshop::GPIO::set_chip_backend(&sim);
+		}
+
+		~SimChip() {
+			YukiWorkshop::GPIO::set_chip_backend(nullptr);
+		}
+
+		std::string path() const {
+			return sim.path(chip);
+		}
+
+		void set_input(uint32_t __line, uint8_t __value) {
+			sim.set_input(chip, __line, __value);
+		}
+
+		uint8_t level(uint32_t __line) const {
+			return sim.level(chip, __line);
+		}
+	};
+
+	// Kills the test (SIGALRM) if it takes longer, so a deadlock fails instead of hanging
+	inline void watchdog(unsigned __seconds) {
+		alarm(__seconds);
+	}
+
+	inline int result(const char *__name) {
+		std::cerr << __name << ": " << (failures ? "FAILED" : "passed") << "\n";
+		return failures ? 1 : 0;
+	}
+}
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+		GPIOTest::failures++; \
+	} \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+	auto check_a_ = (a); auto check_b_ = (b); \
+	if (!(check_a_ == check_b_)) { \
+		std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #a " == " #b " (" << +check_a_ << " vs " << +check_b_ << ")\n"; \
+		GPIOTest::failures++; \
+	} \
+} while (0)